@@ -0,0 +1,164 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "accel.h"
+
+#include <math.h>
+#include <stdio.h>
+
+const struct accel_params accel_default_params = {
+    .profile = ACCEL_EXPONENTIAL,
+
+    .delay = 200,
+    .step = 1,
+    .base_speed = 60,
+    .max_speed = 1600,
+    .ramp = 1000,
+
+    .precision_factor = 0.25
+};
+
+const struct accel_params accel_default_scroll_params = {
+    .profile = ACCEL_EXPONENTIAL,
+
+    .delay = 300,
+    .step = 1,
+    .base_speed = 8,
+    .max_speed = 150,
+    .ramp = 1500,
+
+    .precision_factor = 0.25
+};
+
+static double custom_speed(const struct accel_params *params, double t)
+{
+    const struct accel_point *p = params->points;
+    unsigned int i;
+
+    if (t <= p[0].time)
+        return p[0].speed;
+
+    for (i = 1; i < params->n_points; i++) {
+        if (t <= p[i].time)
+            return p[i - 1].speed + (p[i].speed - p[i - 1].speed) *
+                   (t - p[i - 1].time) / (p[i].time - p[i - 1].time);
+    }
+
+    return p[params->n_points - 1].speed;
+}
+
+static double speed_at(const struct accel_params *params, double t)
+{
+    double speed, ratio = t / params->ramp;
+
+    switch (params->profile) {
+    case ACCEL_EXPONENTIAL:
+        speed = params->base_speed *
+                pow(params->max_speed / params->base_speed, ratio);
+        break;
+    case ACCEL_LINEAR:
+        speed = params->base_speed +
+                (params->max_speed - params->base_speed) * ratio;
+        break;
+    default:
+        speed = custom_speed(params, t);
+        break;
+    }
+
+    return speed < params->max_speed ? speed : params->max_speed;
+}
+
+static int check_params(const struct accel_params *params)
+{
+    unsigned int i;
+
+    // Ordered comparisons are false for NaN
+    if (!isfinite(params->base_speed) || !isfinite(params->max_speed) ||
+        !isfinite(params->step) || !isfinite(params->precision_factor) ||
+        params->base_speed <= 0 || params->max_speed < params->base_speed ||
+        params->step < 0 || params->precision_factor <= 0) {
+        fprintf(stderr, "Invalid acceleration speeds\n");
+        return -1;
+    }
+
+    if (params->profile != ACCEL_CUSTOM) {
+        if (!params->ramp || params->ramp > ACCEL_MAX_TIME) {
+            fprintf(stderr, "Invalid acceleration ramp (1 to %d ms)\n",
+                    ACCEL_MAX_TIME);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (!params->n_points || params->n_points > ACCEL_MAX_POINTS) {
+        fprintf(stderr, "Invalid number of acceleration points\n");
+        return -1;
+    }
+    for (i = 0; i < params->n_points; i++) {
+        if (!isfinite(params->points[i].speed) ||
+            params->points[i].speed < 0 ||
+            (i && params->points[i].time <= params->points[i - 1].time)) {
+            fprintf(stderr, "Invalid acceleration point %u\n", i);
+            return -1;
+        }
+        if (params->points[i].time > ACCEL_MAX_TIME) {
+            fprintf(stderr, "Acceleration point %u is after %d ms, the end "
+                    "of the curve\n", i, ACCEL_MAX_TIME);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int accel_build(struct accel_curve *curve, const struct accel_params *params)
+{
+    double distance = 0, speed, prev_speed;
+    int i;
+
+    if (check_params(params))
+        return -1;
+
+    curve->params = *params;
+
+    // Integrate the speed with the trapezoidal rule
+    prev_speed = speed_at(params, 0);
+    curve->distance[0] = 0;
+    for (i = 1; i < ACCEL_TABLE_SIZE; i++) {
+        speed = speed_at(params, i * ACCEL_TABLE_STEP);
+        distance += (prev_speed + speed) / 2 * ACCEL_TABLE_STEP / 1000;
+        curve->distance[i] = distance;
+        prev_speed = speed;
+    }
+    curve->end_speed = prev_speed;
+
+    return 0;
+}
+
+double accel_distance(const struct accel_curve *curve, unsigned long time)
+{
+    unsigned long i = time / ACCEL_TABLE_STEP;
+    double frac;
+
+    if (i >= ACCEL_TABLE_SIZE - 1)
+        return curve->distance[ACCEL_TABLE_SIZE - 1] + curve->end_speed *
+               (time - (ACCEL_TABLE_SIZE - 1) * ACCEL_TABLE_STEP) / 1000;
+
+    frac = (double) (time % ACCEL_TABLE_STEP) / ACCEL_TABLE_STEP;
+    return curve->distance[i] +
+           (curve->distance[i + 1] - curve->distance[i]) * frac;
+}
@@ -0,0 +1,80 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ACCEL_H
+#define _ACCEL_H
+
+/*
+ * Acceleration curves: speed of the pointer as a function of how long a
+ * movement key has been held. The curve is integrated once into a table of
+ * travelled distances, so that the motion for any time interval is two table
+ * lookups, with no floating point math functions on the hot path.
+ */
+
+enum accel_profile {
+    ACCEL_EXPONENTIAL,  /* from base_speed to max_speed, geometrically */
+    ACCEL_LINEAR,       /* from base_speed to max_speed, linearly */
+    ACCEL_CUSTOM        /* piecewise linear through `points` */
+};
+
+#define ACCEL_MAX_POINTS  16
+
+struct accel_point {
+    unsigned int time;  /* milliseconds after `delay` */
+    double speed;       /* pixels per second */
+};
+
+struct accel_params {
+    enum accel_profile profile;
+
+    unsigned int delay;       /* ms a key is held before moving continuously */
+    double step;              /* pixels moved immediately on key press */
+    double base_speed;        /* pixels per second once `delay` is elapsed */
+    double max_speed;         /* pixels per second, cap for all profiles */
+    unsigned int ramp;        /* ms to go from base_speed to max_speed */
+
+    double precision_factor;  /* speed multiplier with the precision key */
+
+    unsigned int n_points;
+    struct accel_point points[ACCEL_MAX_POINTS];
+};
+
+extern const struct accel_params accel_default_params;
+
+/* For scrolling: speeds are in wheel clicks per second, `step` in clicks */
+extern const struct accel_params accel_default_scroll_params;
+
+/* 512 entries of 8 ms: covers the first 4 seconds of a key being held */
+#define ACCEL_TABLE_SIZE  512
+#define ACCEL_TABLE_STEP  8
+
+/* After this (ms), speed stays constant: ramps and points must end before */
+#define ACCEL_MAX_TIME  ((ACCEL_TABLE_SIZE - 1) * ACCEL_TABLE_STEP)
+
+struct accel_curve {
+    struct accel_params params;
+
+    float distance[ACCEL_TABLE_SIZE];  /* pixels, cumulated */
+    float end_speed;                   /* pixels per second, after the end */
+};
+
+int accel_build(struct accel_curve *curve, const struct accel_params *params);
+
+/* Pixels travelled after moving for `time` ms (i.e. after `delay`) */
+double accel_distance(const struct accel_curve *curve, unsigned long time);
+
+#endif
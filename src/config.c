@@ -16,72 +16,489 @@
  */
 
 #include "config.h"
+#include "loop.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
 #include <yaml.h>
 
-int read_config()
+#define MAX_TICK_RATE  1000
+
+// File being parsed, for error messages
+static const char *parsed_path;
+
+// Watched file
+static struct config *watched_config;
+static config_callback watched_callback;
+static char watched_path[PATH_MAX];
+static const char *watched_name;
+
+void config_defaults(struct config *config)
 {
-    FILE *fh = fopen("config.yml", "r");
-    yaml_parser_t parser;
-    yaml_token_t  token;   /* new variable */
-
-    /* Initialize parser */
-    if (!yaml_parser_initialize(&parser))
-        fputs("Failed to initialize parser!\n", stderr);
-    if (fh == NULL)
-        fputs("Failed to open file!\n", stderr);
-
-    /* Set input file */
-    yaml_parser_set_input_file(&parser, fh);
-
-    /* BEGIN new code */
-    do {
-        yaml_parser_scan(&parser, &token);
-        switch (token.type) {
-        /* Stream start/end */
-        case YAML_STREAM_START_TOKEN:
-            puts("STREAM START");
-            break;
-        case YAML_STREAM_END_TOKEN:
-            puts("STREAM END");
-            break;
-        /* Token types (read before actual token) */
-        case YAML_KEY_TOKEN:
-            printf("(Key token)   ");
-            break;
-        case YAML_VALUE_TOKEN:
-            printf("(Value token) ");
-            break;
-        /* Block delimeters */
-        case YAML_BLOCK_SEQUENCE_START_TOKEN:
-            puts("<b>Start Block (Sequence)</b>");
-            break;
-        case YAML_BLOCK_ENTRY_TOKEN:
-            puts("<b>Start Block (Entry)</b>");
-            break;
-        case YAML_BLOCK_END_TOKEN:
-            puts("<b>End block</b>");
-            break;
-        /* Data */
-        case YAML_BLOCK_MAPPING_START_TOKEN:
-            puts("[Block mapping]");
-            break;
-        case YAML_SCALAR_TOKEN:
-            printf("scalar %s \n", token.data.scalar.value);
-            break;
-        /* Others */
-        default:
-            printf("Got token of type %d\n", token.type);
+    memset(config, 0, sizeof(*config));
+
+    memcpy(config->keys, keymap_default_sequences, sizeof(config->keys));
+    config->accel = accel_default_params;
+    config->scroll_accel = accel_default_scroll_params;
+    config->tick_rate = 0;  /* refresh rate of the monitor */
+}
+
+const char *config_default_path()
+{
+    static char path[PATH_MAX];
+    const char *dir = getenv("XDG_CONFIG_HOME");
+
+    if (dir && *dir)
+        snprintf(path, sizeof(path), "%s/mousemode/config.yml", dir);
+    else if (getenv("HOME"))
+        snprintf(path, sizeof(path), "%s/.config/mousemode/config.yml",
+                 getenv("HOME"));
+    else
+        return "config.yml";
+
+    return path;
+}
+
+static int parse_error(const yaml_node_t *node, const char *message,
+                       const char *detail)
+{
+    fprintf(stderr, "%s:%lu: %s%s%s\n", parsed_path,
+            (unsigned long) node->start_mark.line + 1, message,
+            detail ? ": " : "", detail ? detail : "");
+    return -1;
+}
+
+static const char *scalar(const yaml_node_t *node)
+{
+    if (!node || node->type != YAML_SCALAR_NODE)
+        return NULL;
+    return (const char *) node->data.scalar.value;
+}
+
+/* libyaml keeps all pairs of a mapping: the last one would silently win */
+static int check_duplicates(yaml_document_t *document,
+                            const yaml_node_t *node)
+{
+    const yaml_node_pair_t *pair, *other;
+    const char *name;
+
+    for (pair = node->data.mapping.pairs.start;
+         pair < node->data.mapping.pairs.top; pair++) {
+        name = scalar(yaml_document_get_node(document, pair->key));
+        if (!name)
+            continue;
+        for (other = node->data.mapping.pairs.start; other < pair; other++) {
+            const char *other_name =
+                scalar(yaml_document_get_node(document, other->key));
+            if (other_name && !strcmp(name, other_name))
+                return parse_error(yaml_document_get_node(document,
+                                                          pair->key),
+                                   "Duplicate key", name);
         }
-        if (token.type != YAML_STREAM_END_TOKEN)
-            yaml_token_delete(&token);
-    } while (token.type != YAML_STREAM_END_TOKEN);
+    }
+
+    return 0;
+}
+
+static int parse_double(const yaml_node_t *node, double *value)
+{
+    const char *string = scalar(node);
+    char *end;
+
+    if (!string || !*string)
+        return parse_error(node, "Expected a number", NULL);
+
+    // strtod() takes "nan" and "inf" too: no comparison would catch them
+    errno = 0;
+    *value = strtod(string, &end);
+    if (errno || *end || !isfinite(*value))
+        return parse_error(node, "Invalid number", string);
+
+    return 0;
+}
 
-    yaml_token_delete(&token);
-    /* END new code */
+static int parse_uint(const yaml_node_t *node, unsigned int *value)
+{
+    const char *string = scalar(node);
+    unsigned long result;
+    char *end;
+
+    if (!string || *string < '0' || *string > '9')
+        return parse_error(node, "Expected a positive integer", string);
+
+    errno = 0;
+    result = strtoul(string, &end, 10);
+    if (errno || *end || result > UINT_MAX)
+        return parse_error(node, "Invalid integer", string);
+
+    *value = result;
+    return 0;
+}
+
+static int parse_keys(yaml_document_t *document, const yaml_node_t *node,
+                      struct config *config)
+{
+    const yaml_node_pair_t *pair;
+    enum binding binding, other;
+    const char *name, *value;
+    struct key_sequence *sequence;
+
+    if (node->type != YAML_MAPPING_NODE)
+        return parse_error(node, "Expected a mapping of keys", NULL);
+    if (check_duplicates(document, node))
+        return -1;
+
+    for (pair = node->data.mapping.pairs.start;
+         pair < node->data.mapping.pairs.top; pair++) {
+        const yaml_node_t *key = yaml_document_get_node(document, pair->key);
+        const yaml_node_t *val = yaml_document_get_node(document,
+                                                        pair->value);
+
+        name = scalar(key);
+        binding = name ? binding_from_name(name) : BINDING_NONE;
+        if (binding == BINDING_NONE)
+            return parse_error(key, "Unknown binding", name);
+
+        value = scalar(val);
+        sequence = &config->keys[binding];
+        if (!value || keymap_parse(value, sequence))
+            return parse_error(val, "Invalid keys", value);
+
+        if (binding != BINDING_MOUSE_MODE)
+            continue;
+        if (sequence->length != 1)
+            return parse_error(val, "Expected a single chord", value);
+
+        // Grabbed in normal mode: a bare key would be taken from all apps.
+        // It gets the default modifiers, as before chords were configurable.
+        if (!sequence->chords[0].modifiers)
+            sequence->chords[0].modifiers = keymap_default_sequences
+                [BINDING_MOUSE_MODE].chords[0].modifiers;
+    }
+
+    // A key press resolves to one binding only
+    for (binding = BINDING_NONE + 1; binding < BINDING_COUNT; binding++) {
+        for (other = binding + 1; other < BINDING_COUNT; other++) {
+            if (keymap_conflict(&config->keys[binding],
+                                &config->keys[other])) {
+                fprintf(stderr, "%s: Keys of %s and %s conflict\n",
+                        parsed_path, binding_names[binding],
+                        binding_names[other]);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int parse_points(yaml_document_t *document, const yaml_node_t *node,
+                        struct accel_params *params)
+{
+    const yaml_node_item_t *item;
+    const yaml_node_t *point;
+    double time;
+
+    if (node->type != YAML_SEQUENCE_NODE)
+        return parse_error(node, "Expected a list of points", NULL);
+
+    params->n_points = 0;
+    for (item = node->data.sequence.items.start;
+         item < node->data.sequence.items.top; item++) {
+        point = yaml_document_get_node(document, *item);
+
+        if (params->n_points == ACCEL_MAX_POINTS)
+            return parse_error(point, "Too many points", NULL);
+        if (point->type != YAML_SEQUENCE_NODE ||
+            point->data.sequence.items.top -
+            point->data.sequence.items.start != 2)
+            return parse_error(point, "Expected [time, speed]", NULL);
+
+        if (parse_double(yaml_document_get_node(
+                document, point->data.sequence.items.start[0]), &time) ||
+            parse_double(yaml_document_get_node(
+                document, point->data.sequence.items.start[1]),
+                &params->points[params->n_points].speed))
+            return -1;
+        if (time < 0)
+            return parse_error(point, "Negative time", NULL);
+
+        params->points[params->n_points++].time = time;
+    }
+
+    return 0;
+}
+
+static int parse_accel(yaml_document_t *document, const yaml_node_t *node,
+                       struct accel_params *params)
+{
+    static struct accel_curve curve;
+    const yaml_node_pair_t *pair;
+    const char *name, *value;
+    int ret;
+
+    if (node->type != YAML_MAPPING_NODE)
+        return parse_error(node, "Expected a mapping of parameters", NULL);
+    if (check_duplicates(document, node))
+        return -1;
+
+    for (pair = node->data.mapping.pairs.start;
+         pair < node->data.mapping.pairs.top; pair++) {
+        const yaml_node_t *key = yaml_document_get_node(document, pair->key);
+        const yaml_node_t *val = yaml_document_get_node(document,
+                                                        pair->value);
+
+        name = scalar(key);
+        if (!name) {
+            return parse_error(key, "Expected a parameter name", NULL);
+        } else if (!strcmp(name, "profile")) {
+            value = scalar(val);
+            if (value && !strcmp(value, "exponential"))
+                params->profile = ACCEL_EXPONENTIAL;
+            else if (value && !strcmp(value, "linear"))
+                params->profile = ACCEL_LINEAR;
+            else if (value && !strcmp(value, "custom"))
+                params->profile = ACCEL_CUSTOM;
+            else
+                return parse_error(val, "Unknown profile", value);
+            ret = 0;
+        } else if (!strcmp(name, "delay")) {
+            ret = parse_uint(val, &params->delay);
+        } else if (!strcmp(name, "step")) {
+            ret = parse_double(val, &params->step);
+        } else if (!strcmp(name, "base-speed")) {
+            ret = parse_double(val, &params->base_speed);
+        } else if (!strcmp(name, "max-speed")) {
+            ret = parse_double(val, &params->max_speed);
+        } else if (!strcmp(name, "ramp")) {
+            ret = parse_uint(val, &params->ramp);
+        } else if (!strcmp(name, "precision-factor")) {
+            ret = parse_double(val, &params->precision_factor);
+        } else if (!strcmp(name, "points")) {
+            ret = parse_points(document, val, params);
+        } else {
+            return parse_error(key, "Unknown acceleration parameter", name);
+        }
+        if (ret)
+            return -1;
+    }
+
+    // Same checks as when it is applied, so that applying cannot fail
+    if (accel_build(&curve, params)) {
+        fprintf(stderr, "%s: Invalid acceleration\n", parsed_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int add_display(const yaml_node_t *node, struct config *config)
+{
+    const char *name = scalar(node);
+    int i;
+
+    if (!name || !*name || strlen(name) >= sizeof(config->displays[0]))
+        return parse_error(node, "Invalid display", name);
+    if (config->n_displays == CONFIG_MAX_DISPLAYS)
+        return parse_error(node, "Too many displays", NULL);
+
+    for (i = 0; i < config->n_displays; i++)
+        if (!strcmp(config->displays[i], name))
+            return parse_error(node, "Duplicate display", name);
+
+    strcpy(config->displays[config->n_displays++], name);
+    return 0;
+}
+
+/* One display, or a list of them */
+static int parse_displays(yaml_document_t *document, const yaml_node_t *node,
+                          struct config *config)
+{
+    const yaml_node_item_t *item;
+
+    config->n_displays = 0;
+
+    if (node->type != YAML_SEQUENCE_NODE)
+        return add_display(node, config);
+
+    for (item = node->data.sequence.items.start;
+         item < node->data.sequence.items.top; item++)
+        if (add_display(yaml_document_get_node(document, *item), config))
+            return -1;
+
+    return 0;
+}
+
+static int parse_root(yaml_document_t *document, struct config *config)
+{
+    const yaml_node_t *root = yaml_document_get_root_node(document);
+    const yaml_node_pair_t *pair;
+    const char *name;
+    unsigned int rate;
+
+    // Empty file
+    if (!root)
+        return 0;
+
+    if (root->type != YAML_MAPPING_NODE)
+        return parse_error(root, "Expected a mapping", NULL);
+    if (check_duplicates(document, root))
+        return -1;
+
+    for (pair = root->data.mapping.pairs.start;
+         pair < root->data.mapping.pairs.top; pair++) {
+        const yaml_node_t *key = yaml_document_get_node(document, pair->key);
+        const yaml_node_t *val = yaml_document_get_node(document,
+                                                        pair->value);
+
+        name = scalar(key);
+        if (!name) {
+            return parse_error(key, "Expected a setting name", NULL);
+        } else if (!strcmp(name, "display") || !strcmp(name, "displays")) {
+            if (parse_displays(document, val, config))
+                return -1;
+        } else if (!strcmp(name, "keys")) {
+            if (parse_keys(document, val, config))
+                return -1;
+        } else if (!strcmp(name, "acceleration")) {
+            if (parse_accel(document, val, &config->accel))
+                return -1;
+        } else if (!strcmp(name, "scroll-acceleration")) {
+            if (parse_accel(document, val, &config->scroll_accel))
+                return -1;
+        } else if (!strcmp(name, "tick-rate")) {
+            // 0 stands for auto
+            if (scalar(val) && !strcmp(scalar(val), "auto"))
+                rate = 0;
+            else if (parse_uint(val, &rate))
+                return -1;
+            else if (rate < 1 || rate > MAX_TICK_RATE)
+                return parse_error(val, "Tick rate out of range", NULL);
+            config->tick_rate = rate;
+        } else {
+            return parse_error(key, "Unknown setting", name);
+        }
+    }
+
+    return 0;
+}
+
+int config_load(struct config *config, const char *path, int optional)
+{
+    struct config new;
+    yaml_parser_t parser;
+    yaml_document_t document;
+    FILE *file;
+    int ret = -1;
+
+    file = fopen(path, "r");
+    if (!file) {
+        if (optional && errno == ENOENT)
+            return 0;
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (!yaml_parser_initialize(&parser)) {
+        fprintf(stderr, "Cannot initialize YAML parser\n");
+        fclose(file);
+        return -1;
+    }
+    yaml_parser_set_input_file(&parser, file);
+
+    if (!yaml_parser_load(&parser, &document)) {
+        fprintf(stderr, "%s:%lu: %s\n", path,
+                (unsigned long) parser.problem_mark.line + 1,
+                parser.problem ? parser.problem : "Invalid YAML");
+    } else {
+        // Missing settings are reset, commit only if all is valid
+        config_defaults(&new);
+        parsed_path = path;
+        ret = parse_root(&document, &new);
+        if (!ret)
+            *config = new;
+        yaml_document_delete(&document);
+    }
 
-    /* Cleanup */
     yaml_parser_delete(&parser);
-    fclose(fh);
+    fclose(file);
+    return ret;
+}
+
+static void on_inotify_readable(int fd, void *data)
+{
+    char buf[4096]
+    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    int changed = 0;
+    ssize_t size;
+    char *p;
+
+    while ((size = read(fd, buf, sizeof(buf))) > 0) {
+        for (p = buf; p < buf + size; p += sizeof(*event) + event->len) {
+            event = (const struct inotify_event *) p;
+
+            if (event->len && !strcmp(event->name, watched_name))
+                changed = 1;
+        }
+    }
+
+    // Editors write several times: reload once per wakeup
+    if (!changed)
+        return;
+
+    if (config_load(watched_config, watched_path, 0)) {
+        fprintf(stderr, "Keeping the previous config\n");
+        return;
+    }
+
+    printf("Reloaded %s\n", watched_path);
+    watched_callback(watched_config);
+}
+
+int config_watch(struct config *config, const char *path,
+                 config_callback callback)
+{
+    char dir[PATH_MAX];
+    char *slash;
+    int fd;
+
+    if (strlen(path) >= sizeof(watched_path)) {
+        fprintf(stderr, "Config path too long\n");
+        return -1;
+    }
+    strcpy(watched_path, path);
+    strcpy(dir, path);
+
+    // Watch the directory: editors often replace the file with a new one
+    slash = strrchr(dir, '/');
+    if (slash) {
+        *slash = '\0';
+        watched_name = watched_path + (slash - dir) + 1;
+    } else {
+        strcpy(dir, ".");
+        watched_name = watched_path;
+    }
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 ||
+        inotify_add_watch(fd, *dir ? dir : "/",
+                          IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        fprintf(stderr, "Cannot watch %s: %s\n", dir, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    watched_config = config;
+    watched_callback = callback;
+    loop_add_fd(fd, on_inotify_readable, NULL);
+
     return 0;
 }
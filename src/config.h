@@ -18,6 +18,61 @@
 #ifndef _CONFIG_H
 #define _CONFIG_H
 
-int read_config();
+#include <X11/Xlib.h>
+
+#include "accel.h"
+#include "keyboard.h"
+#include "keymap.h"
+
+/*
+ * The YAML file is parsed once into this struct, and checked as a whole: a
+ * config is either entirely valid, or not used at all. Example:
+ *
+ *   displays: [":0", ":1"]
+ *   keys:
+ *     up: K
+ *     left-click: F
+ *     mouse-mode: Ctrl+Super+Alt_L
+ *     jump: g g
+ *   acceleration:
+ *     profile: exponential
+ *     max-speed: 1600
+ *   scroll-acceleration:
+ *     max-speed: 150
+ *   tick-rate: auto
+ *
+ * Missing entries keep their default value.
+ */
+#define CONFIG_MAX_DISPLAYS  64
+
+struct config {
+    char displays[CONFIG_MAX_DISPLAYS][64];  /* none: use $DISPLAY */
+    int n_displays;
+    struct key_sequence keys[BINDING_COUNT];
+    struct accel_params accel;
+    struct accel_params scroll_accel;        /* in wheel clicks */
+    unsigned int tick_rate;                  /* Hz, 0: monitor refresh */
+};
+
+void config_defaults(struct config *config);
+
+/* Default path: $XDG_CONFIG_HOME/mousemode/config.yml */
+const char *config_default_path();
+
+/*
+ * Parse and check `path` into `config`. On error, print why and return -1:
+ * `config` is left untouched. A missing file is not an error if `optional`.
+ */
+int config_load(struct config *config, const char *path, int optional);
+
+typedef void (*config_callback)(const struct config *config);
+
+/*
+ * Watch `path` with inotify from the event loop, reload it when it is
+ * written or replaced, and call `callback` with the new config if it is
+ * valid. `config` is the one in use, it is updated in place.
+ */
+int config_watch(struct config *config, const char *path,
+                 config_callback callback);
 
 #endif
@@ -0,0 +1,433 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "control.h"
+#include "keyboard.h"
+#include "loop.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define MAX_CLIENTS   16
+#define BUFFER_SIZE   4096
+
+// X coordinates are 16-bit: so are moves, positions and scrolls
+#define MAX_ARGUMENT  32767
+
+struct client {
+    int fd;  /* -1 if the slot is free */
+    int timer;
+
+    // In a `wait`: the socket is not read, buffered lines wait too
+    int waiting;
+
+    // As given by `display`, empty for the first one
+    char display[64];
+
+    char in[BUFFER_SIZE];
+    size_t in_length;
+    char out[BUFFER_SIZE];
+    size_t out_length;
+
+    // Sum of consecutive moves, not sent yet
+    int move_pending;
+    int move_x, move_y;
+
+    // Replies could not be sent: close once the batch is over
+    int broken;
+};
+
+static struct client clients[MAX_CLIENTS];
+
+static int listen_fd = -1;
+static struct sockaddr_un address;
+
+static control_command_callback command_callback;
+static control_batch_callback batch_callback;
+
+static void close_client(struct client *client)
+{
+    loop_remove_timer(client->timer);
+    if (!client->waiting)
+        loop_remove_fd(client->fd);
+    close(client->fd);
+    client->fd = -1;
+}
+
+/* Replies are sent at the end of a batch, or when the buffer is full */
+static void send_replies(struct client *client)
+{
+    ssize_t size;
+
+    if (!client->out_length)
+        return;
+
+    // Closed once the batch is over: replies are dropped until then
+    if (client->broken) {
+        client->out_length = 0;
+        return;
+    }
+
+    // A client that does not read its replies must not block us
+    size = send(client->fd, client->out, client->out_length,
+                MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (size != client->out_length) {
+        if (size < 0 && errno != EAGAIN && errno != EPIPE)
+            perror("send");
+        client->broken = 1;
+    }
+    client->out_length = 0;
+}
+
+static void reply(struct client *client, const char *text)
+{
+    size_t length = strlen(text);
+
+    if (client->broken)
+        return;
+
+    if (client->out_length + length + 1 > sizeof(client->out))
+        send_replies(client);
+
+    memcpy(client->out + client->out_length, text, length);
+    client->out[client->out_length + length] = '\n';
+    client->out_length += length + 1;
+}
+
+static int apply(struct client *client, const struct control_command *command)
+{
+    return command_callback(client->display, command);
+}
+
+static void send_move(struct client *client)
+{
+    struct control_command command = { .type = CONTROL_MOVE };
+
+    if (!client->move_pending)
+        return;
+
+    command.x = client->move_x;
+    command.y = client->move_y;
+    apply(client, &command);
+
+    client->move_pending = 0;
+    client->move_x = client->move_y = 0;
+}
+
+/*
+ * Parse `n` integers between `min` and `max` and nothing else, return -1 on
+ * error
+ */
+static int parse_integers(const char *args, int n, long min, long max,
+                          long *values)
+{
+    char *end;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        errno = 0;
+        values[i] = strtol(args, &end, 10);
+        if (end == args || errno || values[i] < min || values[i] > max)
+            return -1;
+        args = end;
+    }
+
+    while (isspace(*args))
+        args++;
+    return *args ? -1 : 0;
+}
+
+static const struct {
+    const char *name;
+    enum control_type type;
+    int n_args;
+} commands[] = {
+    { "move",    CONTROL_MOVE,    2 },
+    { "moveto",  CONTROL_MOVE_TO, 2 },
+    { "press",   CONTROL_PRESS,   1 },
+    { "release", CONTROL_RELEASE, 1 },
+    { "click",   CONTROL_CLICK,   1 },
+    { "scroll",  CONTROL_SCROLL,  2 }
+};
+
+static void start_wait(struct client *client, unsigned long milliseconds)
+{
+    // Actions before the wait must be seen before it
+    send_move(client);
+    batch_callback();
+    send_replies(client);
+
+    client->waiting = 1;
+    loop_remove_fd(client->fd);
+    loop_set_oneshot_timer(client->timer,
+                           current_microseconds() + milliseconds * 1000);
+}
+
+static void process_display(struct client *client, const char *args)
+{
+    struct control_command command = { .type = CONTROL_DISPLAY };
+    char name[sizeof(client->display)], previous[sizeof(client->display)];
+    int n = 0;
+
+    if (sscanf(args, "%63s %n", name, &n) != 1 || args[n]) {
+        reply(client, "error: usage: display NAME");
+        return;
+    }
+
+    send_move(client);
+
+    strcpy(previous, client->display);
+    strcpy(client->display, name);
+    if (apply(client, &command)) {
+        strcpy(client->display, previous);
+        reply(client, "error: unknown display");
+        return;
+    }
+    reply(client, "ok");
+}
+
+static void process_line(struct client *client, char *line)
+{
+    struct control_command command;
+    char name[16];
+    long values[2];
+    int i, n = 0;
+
+    // Empty lines get no reply
+    if (sscanf(line, "%15s %n", name, &n) != 1)
+        return;
+
+    if (!strcmp(name, "display")) {
+        process_display(client, line + n);
+        return;
+    }
+
+    if (!strcmp(name, "wait")) {
+        if (parse_integers(line + n, 1, 0, INT_MAX, values)) {
+            reply(client, "error: usage: wait MS");
+            return;
+        }
+        start_wait(client, values[0]);
+        return;
+    }
+
+    for (i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+        if (!strcmp(name, commands[i].name))
+            break;
+    if (i == sizeof(commands) / sizeof(commands[0])) {
+        reply(client, "error: unknown command");
+        return;
+    }
+
+    if (parse_integers(line + n, commands[i].n_args, -MAX_ARGUMENT,
+                       MAX_ARGUMENT, values)) {
+        reply(client, "error: bad arguments");
+        return;
+    }
+
+    memset(&command, 0, sizeof(command));
+    command.type = commands[i].type;
+    if (commands[i].n_args == 1) {
+        if (values[0] < 1 || values[0] > 255) {
+            reply(client, "error: bad button");
+            return;
+        }
+        command.button = values[0];
+    } else {
+        command.x = values[0];
+        command.y = values[1];
+    }
+
+    if (command.type == CONTROL_MOVE) {
+        // Checks the display, without sending anything
+        command.type = CONTROL_DISPLAY;
+        if (!client->move_pending && apply(client, &command)) {
+            reply(client, "error: unknown display");
+            return;
+        }
+        client->move_pending = 1;
+        client->move_x += command.x;
+        client->move_y += command.y;
+        reply(client, "ok");
+        return;
+    }
+
+    send_move(client);
+    reply(client, apply(client, &command) ? "error: unknown display" : "ok");
+}
+
+static void process_batch(struct client *client)
+{
+    char *line = client->in, *end;
+    size_t left = client->in_length;
+
+    while (!client->waiting && (end = memchr(line, '\n', left))) {
+        *end = '\0';
+        process_line(client, line);
+        left -= end + 1 - line;
+        line = end + 1;
+    }
+    memmove(client->in, line, left);
+    client->in_length = left;
+
+    if (!client->waiting) {
+        send_move(client);
+        batch_callback();
+        send_replies(client);
+    }
+
+    if (client->broken) {
+        fprintf(stderr, "Control client not reading its replies\n");
+        close_client(client);
+    } else if (!client->waiting && client->in_length == sizeof(client->in)) {
+        fprintf(stderr, "Control line too long\n");
+        close_client(client);
+    }
+}
+
+static void on_client_readable(int fd, void *data)
+{
+    struct client *client = data;
+    ssize_t size;
+
+    size = read(fd, client->in + client->in_length,
+                sizeof(client->in) - client->in_length);
+    if (size < 0 && errno == EAGAIN)
+        return;
+    if (size <= 0) {
+        close_client(client);
+        return;
+    }
+
+    client->in_length += size;
+
+    // One batch per read: a client writing faster than we act gets bigger
+    // batches, not more flushes
+    process_batch(client);
+}
+
+static void on_wait_done(unsigned long expirations, void *data)
+{
+    struct client *client = data;
+
+    client->waiting = 0;
+    loop_add_fd(client->fd, on_client_readable, client);
+
+    reply(client, "ok");
+    process_batch(client);
+}
+
+static void on_connection(int fd, void *data)
+{
+    struct client *client = NULL;
+    int i, client_fd;
+
+    client_fd = accept(fd, NULL, NULL);
+    if (client_fd < 0) {
+        perror("accept");
+        return;
+    }
+    fcntl(client_fd, F_SETFL, O_NONBLOCK);
+    fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+
+    for (i = 0; i < MAX_CLIENTS; i++)
+        if (clients[i].fd < 0)
+            client = &clients[i];
+    if (!client) {
+        fprintf(stderr, "Too many control clients\n");
+        close(client_fd);
+        return;
+    }
+
+    memset(client, 0, sizeof(*client));
+    client->fd = client_fd;
+    client->timer = loop_add_timer(on_wait_done, client);
+    loop_add_fd(client_fd, on_client_readable, client);
+}
+
+int control_init(const char *path,
+                 control_command_callback on_command,
+                 control_batch_callback on_batch)
+{
+    struct stat st;
+    mode_t mask;
+    int i;
+
+    for (i = 0; i < MAX_CLIENTS; i++)
+        clients[i].fd = -1;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    // Left by a previous run, but never remove anything else
+    if (!lstat(path, &st) && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    // Whoever can connect drives the pointer: only the user
+    mask = umask(0077);
+    if (bind(listen_fd, (struct sockaddr *) &address, sizeof(address)) ||
+        listen(listen_fd, MAX_CLIENTS)) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", path, strerror(errno));
+        umask(mask);
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    umask(mask);
+
+    command_callback = on_command;
+    batch_callback = on_batch;
+    loop_add_fd(listen_fd, on_connection, NULL);
+
+    return 0;
+}
+
+void control_close()
+{
+    int i;
+
+    if (listen_fd < 0)
+        return;
+
+    for (i = 0; i < MAX_CLIENTS; i++)
+        if (clients[i].fd >= 0)
+            close_client(&clients[i]);
+
+    loop_remove_fd(listen_fd);
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(address.sun_path);
+}
@@ -0,0 +1,68 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CONTROL_H
+#define _CONTROL_H
+
+/*
+ * Local socket for scripts driving the pointer, without a process per
+ * action. The protocol is text, one command per line:
+ *
+ *   display NAME   next commands go to this display (default: the first)
+ *   move DX DY     relative, in pixels
+ *   moveto X Y     absolute
+ *   press BUTTON   1 left, 2 middle, 3 right
+ *   release BUTTON
+ *   click BUTTON   press and release
+ *   scroll DX DY   in wheel clicks, positive is down and right
+ *   wait MS        pause this connection
+ *
+ * Arguments are integers, within the 16-bit range of X coordinates (but for
+ * MS).
+ * Each line is answered with "ok" or "error: REASON". Commands are applied
+ * in order, but all those read at once make a batch: consecutive moves are
+ * summed, and requests are flushed once at the end.
+ */
+enum control_type {
+    CONTROL_DISPLAY,
+    CONTROL_MOVE,
+    CONTROL_MOVE_TO,
+    CONTROL_PRESS,
+    CONTROL_RELEASE,
+    CONTROL_CLICK,
+    CONTROL_SCROLL
+};
+
+struct control_command {
+    enum control_type type;
+    int x, y;
+    unsigned int button;
+};
+
+/* Return -1 if `display` ("" for the first one) is not served */
+typedef int (*control_command_callback)(const char *display,
+                                        const struct control_command *command);
+
+/* End of a batch: flush requests */
+typedef void (*control_batch_callback)();
+
+int control_init(const char *path, control_command_callback command_callback,
+                 control_batch_callback batch_callback);
+
+void control_close();
+
+#endif
@@ -0,0 +1,338 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "evdev.h"
+#include "keyboard.h"
+#include "loop.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/input.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <X11/X.h>
+
+#define INPUT_DIR     "/dev/input"
+
+#define MAX_DEVICES   32
+#define MAX_EVENTS    64
+
+#define BITS_PER_LONG  (sizeof(long) * 8)
+#define NLONGS(n)      (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+struct device {
+    int fd;  /* -1 if the slot is free */
+    char name[32];
+    int grabbed;
+
+    // Keys down, as seen in the events read so far
+    unsigned long keys[NLONGS(KEY_CNT)];
+};
+
+static struct device devices[MAX_DEVICES];
+
+static evdev_key_callback key_callback;
+static evdev_batch_callback batch_callback;
+
+// Whether keyboards should be grabbed (once all their keys are up)
+static int grab_wanted;
+
+static int test_bit(const unsigned long *bits, int bit)
+{
+    return (bits[bit / BITS_PER_LONG] >> (bit % BITS_PER_LONG)) & 1;
+}
+
+static void set_bit(unsigned long *bits, int bit, int value)
+{
+    if (value)
+        bits[bit / BITS_PER_LONG] |= 1UL << (bit % BITS_PER_LONG);
+    else
+        bits[bit / BITS_PER_LONG] &= ~(1UL << (bit % BITS_PER_LONG));
+}
+
+static int any_key_down(const struct device *device)
+{
+    int i;
+
+    for (i = 0; i < NLONGS(KEY_CNT); i++)
+        if (device->keys[i])
+            return 1;
+    return 0;
+}
+
+static void update_grab(struct device *device)
+{
+    if (device->grabbed == grab_wanted)
+        return;
+
+    // Until all keys are up, key events still go to other clients too
+    if (grab_wanted && any_key_down(device))
+        return;
+
+    if (ioctl(device->fd, EVIOCGRAB, (void *) (long) grab_wanted)) {
+        fprintf(stderr, "Cannot %s %s: %s\n",
+                grab_wanted ? "grab" : "ungrab", device->name,
+                strerror(errno));
+        return;
+    }
+    device->grabbed = grab_wanted;
+}
+
+static void close_device(struct device *device)
+{
+    unsigned long time = current_milliseconds();
+    int i;
+
+    printf("Keyboard removed: %s\n", device->name);
+
+    // Unplugged with keys down: they would stay down forever
+    for (i = 0; i < KEY_CNT; i++) {
+        if (test_bit(device->keys, i)) {
+            set_bit(device->keys, i, 0);
+            if (i + 8 < 256)
+                key_callback(KeyRelease, i + 8, time);
+        }
+    }
+
+    loop_remove_fd(device->fd);
+    close(device->fd);
+    device->fd = -1;
+}
+
+/* The kernel dropped events: release keys that are not down anymore */
+static void resync_keys(struct device *device, unsigned long time)
+{
+    unsigned long keys[NLONGS(KEY_CNT)];
+    int i;
+
+    if (ioctl(device->fd, EVIOCGKEY(sizeof(keys)), keys) < 0)
+        return;
+
+    for (i = 0; i < KEY_CNT; i++) {
+        if (test_bit(device->keys, i) && !test_bit(keys, i)) {
+            set_bit(device->keys, i, 0);
+            if (i + 8 < 256)
+                key_callback(KeyRelease, i + 8, time);
+        }
+    }
+}
+
+static unsigned long event_milliseconds(const struct input_event *event)
+{
+    return event->input_event_sec * 1000 +
+           event->input_event_usec / 1000;
+}
+
+static void on_device_readable(int fd, void *data)
+{
+    struct device *device = data;
+    struct input_event events[MAX_EVENTS];
+    ssize_t size;
+    int i, n;
+
+    while ((size = read(fd, events, sizeof(events))) > 0) {
+        n = size / sizeof(events[0]);
+
+        for (i = 0; i < n; i++) {
+            const struct input_event *event = &events[i];
+
+            if (event->type == EV_SYN && event->code == SYN_DROPPED) {
+                resync_keys(device, event_milliseconds(event));
+                continue;
+            }
+
+            // Value 2 is an autorepeat
+            if (event->type != EV_KEY || event->value == 2 ||
+                event->code >= KEY_CNT)
+                continue;
+
+            set_bit(device->keys, event->code, event->value);
+
+            if (event->code + 8 < 256)
+                key_callback(event->value ? KeyPress : KeyRelease,
+                             event->code + 8, event_milliseconds(event));
+        }
+    }
+
+    if (size < 0 && errno != EAGAIN) {
+        // ENODEV: unplugged
+        close_device(device);
+    } else {
+        update_grab(device);
+    }
+
+    batch_callback();
+}
+
+static int is_keyboard(int fd)
+{
+    unsigned long types[NLONGS(EV_CNT)] = { 0 };
+    unsigned long keys[NLONGS(KEY_CNT)] = { 0 };
+
+    if (ioctl(fd, EVIOCGBIT(0, sizeof(types)), types) < 0 ||
+        !test_bit(types, EV_KEY))
+        return 0;
+    if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys) < 0)
+        return 0;
+
+    // Not power buttons, mice nor our own uinput pointer
+    return test_bit(keys, KEY_ESC) && test_bit(keys, KEY_A) &&
+           test_bit(keys, KEY_SPACE);
+}
+
+static void open_device(const char *name)
+{
+    char path[PATH_MAX];
+    struct device *device = NULL;
+    int i, fd, clock = CLOCK_MONOTONIC;
+
+    for (i = 0; i < MAX_DEVICES; i++) {
+        if (devices[i].fd >= 0 && !strcmp(devices[i].name, name))
+            return;  // already open
+        if (devices[i].fd < 0 && !device)
+            device = &devices[i];
+    }
+    if (!device) {
+        fprintf(stderr, "Too many input devices, ignoring %s\n", name);
+        return;
+    }
+
+    snprintf(path, sizeof(path), INPUT_DIR "/%s", name);
+    fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return;  // no permission yet, or not a device
+
+    if (!is_keyboard(fd)) {
+        close(fd);
+        return;
+    }
+
+    // Timestamps in the same clock as current_milliseconds()
+    if (ioctl(fd, EVIOCSCLOCKID, &clock))
+        perror("EVIOCSCLOCKID");
+
+    memset(device, 0, sizeof(*device));
+    device->fd = fd;
+    strncpy(device->name, name, sizeof(device->name) - 1);
+    if (ioctl(fd, EVIOCGKEY(sizeof(device->keys)), device->keys) < 0)
+        memset(device->keys, 0, sizeof(device->keys));
+
+    loop_add_fd(fd, on_device_readable, device);
+    update_grab(device);
+
+    printf("Keyboard added: %s\n", name);
+}
+
+static void on_inotify_readable(int fd, void *data)
+{
+    char buf[4096]
+    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    ssize_t size;
+    char *p;
+
+    while ((size = read(fd, buf, sizeof(buf))) > 0) {
+        for (p = buf; p < buf + size; p += sizeof(*event) + event->len) {
+            event = (const struct inotify_event *) p;
+
+            // Permissions are often set after creation: retry on IN_ATTRIB
+            if (event->len && !strncmp(event->name, "event", 5))
+                open_device(event->name);
+        }
+    }
+}
+
+int evdev_init(evdev_key_callback key_cb, evdev_batch_callback batch_cb)
+{
+    struct dirent *entry;
+    DIR *dir;
+    int i, fd;
+
+    key_callback = key_cb;
+    batch_callback = batch_cb;
+
+    for (i = 0; i < MAX_DEVICES; i++)
+        devices[i].fd = -1;
+
+    // Watch before listing, not to miss a keyboard plugged in between
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 ||
+        inotify_add_watch(fd, INPUT_DIR, IN_CREATE | IN_ATTRIB) < 0) {
+        perror("Cannot watch " INPUT_DIR);
+        return -1;
+    }
+    loop_add_fd(fd, on_inotify_readable, NULL);
+
+    dir = opendir(INPUT_DIR);
+    if (!dir) {
+        perror("Cannot open " INPUT_DIR);
+        return -1;
+    }
+    while ((entry = readdir(dir)))
+        if (!strncmp(entry->d_name, "event", 5))
+            open_device(entry->d_name);
+    closedir(dir);
+
+    for (i = 0; i < MAX_DEVICES; i++)
+        if (devices[i].fd >= 0)
+            return 0;
+
+    fprintf(stderr, "No readable keyboard in " INPUT_DIR "\n");
+    return -1;
+}
+
+void evdev_grab(int grab)
+{
+    int i;
+
+    grab_wanted = grab;
+
+    for (i = 0; i < MAX_DEVICES; i++)
+        if (devices[i].fd >= 0)
+            update_grab(&devices[i]);
+}
+
+unsigned int evdev_modifiers()
+{
+    static const struct {
+        int key;
+        unsigned int mask;
+    } modifiers[] = {
+        { KEY_LEFTSHIFT, ShiftMask }, { KEY_RIGHTSHIFT, ShiftMask },
+        { KEY_LEFTCTRL, ControlMask }, { KEY_RIGHTCTRL, ControlMask },
+        { KEY_LEFTALT, Mod1Mask }, { KEY_RIGHTALT, Mod1Mask },
+        { KEY_LEFTMETA, Mod4Mask }, { KEY_RIGHTMETA, Mod4Mask }
+    };
+    unsigned int mask = 0;
+    int i, j;
+
+    for (i = 0; i < MAX_DEVICES; i++) {
+        if (devices[i].fd < 0)
+            continue;
+        for (j = 0; j < sizeof(modifiers) / sizeof(modifiers[0]); j++)
+            if (test_bit(devices[i].keys, modifiers[j].key))
+                mask |= modifiers[j].mask;
+    }
+
+    return mask;
+}
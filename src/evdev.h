@@ -0,0 +1,50 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _EVDEV_H
+#define _EVDEV_H
+
+/*
+ * evdev key input: keyboards are read directly from /dev/input/event*,
+ * through the event loop. Keyboards plugged later are opened when they
+ * appear (inotify on /dev/input).
+ *
+ * Keycodes are evdev codes + 8, i.e. X keycodes with the evdev and libinput
+ * drivers. Times are kernel timestamps, in milliseconds of CLOCK_MONOTONIC.
+ * Autorepeats are dropped: the kernel flags them.
+ */
+
+typedef void (*evdev_key_callback)(int type, unsigned char keycode,
+                                   unsigned long time);
+
+/* Called after all events available on a device are read */
+typedef void (*evdev_batch_callback)();
+
+int evdev_init(evdev_key_callback key_callback,
+               evdev_batch_callback batch_callback);
+
+/*
+ * Grab (or release) keyboards exclusively: while grabbed, nobody else gets
+ * their events. A keyboard is only grabbed once all its keys are up, so that
+ * other clients do not miss releases of keys held at that time.
+ */
+void evdev_grab(int grab);
+
+/* X modifier mask (ShiftMask, ControlMask...) of the keys currently down */
+unsigned int evdev_modifiers();
+
+#endif
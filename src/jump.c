@@ -0,0 +1,140 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jump.h"
+
+#include <X11/Xutil.h>
+#include <X11/extensions/shape.h>
+
+#define LINE_WIDTH  2
+#define LINE_COLOR  "red"
+
+static void create_window(struct jump *jump)
+{
+    Display *display = jump->display;
+    XSetWindowAttributes attributes;
+    XColor color, exact;
+
+    attributes.override_redirect = True;
+    attributes.save_under = True;
+    attributes.background_pixel = WhitePixel(display, DefaultScreen(display));
+    if (XAllocNamedColor(display, DefaultColormap(display,
+                                                  DefaultScreen(display)),
+                         LINE_COLOR, &color, &exact))
+        attributes.background_pixel = color.pixel;
+
+    jump->window = XCreateWindow(display, DefaultRootWindow(display),
+                                 0, 0, 1, 1, 0, CopyFromParent, InputOutput,
+                                 CopyFromParent,
+                                 CWOverrideRedirect | CWSaveUnder |
+                                 CWBackPixel, &attributes);
+
+    // Clicks at the center of the grid must go through it
+    XShapeCombineRectangles(display, jump->window, ShapeInput, 0, 0, NULL, 0,
+                            ShapeSet, Unsorted);
+}
+
+void jump_init(struct jump *jump, Display *display, struct mouse *mouse)
+{
+    jump->display = display;
+    jump->mouse = mouse;
+    jump->active = 0;
+
+    // The color is a round-trip: not when jump mode starts, with the motion
+    // lock held
+    create_window(jump);
+}
+
+/*
+ * The window covers the area, and its shape is the grid lines: the server
+ * paints them with the background color, nothing else is ever drawn.
+ */
+static void update_window(struct jump *jump)
+{
+    int w = jump->area_width, h = jump->area_height, line = LINE_WIDTH;
+    XRectangle lines[6] = {
+        { 0, 0, w, line },                       /* top */
+        { 0, h - line, w, line },                /* bottom */
+        { 0, 0, line, h },                       /* left */
+        { w - line, 0, line, h },                /* right */
+        { w / 2 - line / 2, 0, line, h },        /* vertical */
+        { 0, h / 2 - line / 2, w, line }         /* horizontal */
+    };
+
+    XMoveResizeWindow(jump->display, jump->window, jump->area_x,
+                      jump->area_y, w, h);
+    XShapeCombineRectangles(jump->display, jump->window, ShapeBounding, 0, 0,
+                            lines, 6, ShapeSet, Unsorted);
+}
+
+static void move_pointer_to_center(struct jump *jump)
+{
+    mouse_move_to(jump->mouse, jump->area_x + jump->area_width / 2,
+                  jump->area_y + jump->area_height / 2);
+}
+
+void jump_start(struct jump *jump, int x, int y, int width, int height)
+{
+    jump->area_x = x;
+    jump->area_y = y;
+    jump->area_width = width;
+    jump->area_height = height;
+    jump->active = 1;
+
+    update_window(jump);
+    XMapRaised(jump->display, jump->window);
+    move_pointer_to_center(jump);
+}
+
+void jump_stop(struct jump *jump)
+{
+    if (!jump->active)
+        return;
+
+    jump->active = 0;
+    XUnmapWindow(jump->display, jump->window);
+}
+
+int jump_active(const struct jump *jump)
+{
+    return jump->active;
+}
+
+void jump_narrow(struct jump *jump, enum binding binding)
+{
+    switch (binding) {
+    case BINDING_LEFT:
+        jump->area_width -= jump->area_width / 2;
+        break;
+    case BINDING_RIGHT:
+        jump->area_x += jump->area_width / 2;
+        jump->area_width -= jump->area_width / 2;
+        break;
+    case BINDING_UP:
+        jump->area_height -= jump->area_height / 2;
+        break;
+    case BINDING_DOWN:
+        jump->area_y += jump->area_height / 2;
+        jump->area_height -= jump->area_height / 2;
+        break;
+    default:
+        return;
+    }
+
+    update_window(jump);
+    move_pointer_to_center(jump);
+}
@@ -0,0 +1,60 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JUMP_H
+#define _JUMP_H
+
+#include <X11/Xlib.h>
+
+#include "keyboard.h"
+#include "mouse.h"
+
+/*
+ * Jump mode, keynav-style: a grid splits an area of the screen in four, each
+ * movement key keeps one half of it and the pointer jumps to the center. Any
+ * pixel is reached in about log2(width) + log2(height) keystrokes.
+ *
+ * The grid is an override-redirect window shaped (XShape) to its lines only,
+ * so the server only paints the lines that changed, and with an empty input
+ * shape so that clicks go through it.
+ */
+
+/* Jump mode of a display. Members are private: use the functions below. */
+struct jump {
+    Display *display;
+    struct mouse *mouse;
+
+    Window window;
+    int active;
+
+    // Current area, in root window coordinates
+    int area_x, area_y, area_width, area_height;
+};
+
+void jump_init(struct jump *jump, Display *display, struct mouse *mouse);
+
+/* Start on the area (x, y, width, height), usually a monitor */
+void jump_start(struct jump *jump, int x, int y, int width, int height);
+
+void jump_stop(struct jump *jump);
+
+int jump_active(const struct jump *jump);
+
+/* Keep the half of the area for a movement binding */
+void jump_narrow(struct jump *jump, enum binding binding);
+
+#endif
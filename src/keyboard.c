@@ -16,73 +16,131 @@
  */
 
 #include "keyboard.h"
+#include "stats.h"
 
 #include <stdio.h>
-#include <math.h>
-#include <X11/keysym.h>
-
-struct keyboard_mapping {
-    KeyCode up;
-    KeyCode down;
-    KeyCode left;
-    KeyCode right;
-
-    KeyCode lclick;
-    KeyCode mclick;
-    KeyCode rclick;
-};
+#include <string.h>
 
-static struct keyboard_mapping mapping;
+const char *const binding_names[BINDING_COUNT] = {
+    [BINDING_UP]           = "up",
+    [BINDING_DOWN]         = "down",
+    [BINDING_LEFT]         = "left",
+    [BINDING_RIGHT]        = "right",
 
-struct key_state {
-    enum { POS_UP, POS_DOWN } position;
+    [BINDING_LCLICK]       = "left-click",
+    [BINDING_MCLICK]       = "middle-click",
+    [BINDING_RCLICK]       = "right-click",
 
-    unsigned long press_time;
-    unsigned long release_time;
-    unsigned long last_action_time;
+    [BINDING_PRECISION]    = "precision",
 
-    enum { ACTION_NONE, ACTION_PRESS, ACTION_RELEASE } pending;
-};
+    [BINDING_MOUSE_MODE]   = "mouse-mode",
+    [BINDING_NORMAL_MODE]  = "normal-mode",
 
-struct keyboard_state {
-    struct key_state up;
-    struct key_state down;
-    struct key_state left;
-    struct key_state right;
+    [BINDING_JUMP]         = "jump",
 
-    struct key_state lclick;
-    struct key_state mclick;
-    struct key_state rclick;
-};
+    [BINDING_PREV_MONITOR] = "previous-monitor",
+    [BINDING_NEXT_MONITOR] = "next-monitor",
 
-static struct keyboard_state kb_state = {
-    .up     = { .position = POS_UP },
-    .down   = { .position = POS_UP },
-    .left   = { .position = POS_UP },
-    .right  = { .position = POS_UP },
-    .lclick = { .position = POS_UP },
-    .mclick = { .position = POS_UP },
-    .rclick = { .position = POS_UP }
+    [BINDING_SCROLL_UP]    = "scroll-up",
+    [BINDING_SCROLL_DOWN]  = "scroll-down",
+    [BINDING_SCROLL_LEFT]  = "scroll-left",
+    [BINDING_SCROLL_RIGHT] = "scroll-right",
+
+    [BINDING_SNAP_UP]      = "snap-up",
+    [BINDING_SNAP_DOWN]    = "snap-down",
+    [BINDING_SNAP_LEFT]    = "snap-left",
+    [BINDING_SNAP_RIGHT]   = "snap-right"
 };
 
-void set_mapping(Display *display)
+enum binding binding_from_name(const char *name)
+{
+    int i;
+
+    for (i = BINDING_NONE + 1; i < BINDING_COUNT; i++)
+        if (!strcmp(binding_names[i], name))
+            return i;
+
+    return BINDING_NONE;
+}
+
+static struct accel_curve default_curve, default_scroll_curve;
+
+static unsigned long default_clock()
+{
+    return current_milliseconds();
+}
+
+void keyboard_init(struct keyboard *kb, unsigned long (*clock)())
+{
+    memset(kb, 0, sizeof(*kb));
+
+    kb->clock = clock ? clock : default_clock;
+    // Built once, for all keyboards
+    if (!default_curve.params.max_speed) {
+        accel_build(&default_curve, &accel_default_params);
+        accel_build(&default_scroll_curve, &accel_default_scroll_params);
+    }
+    kb->curve = &default_curve;
+    kb->scroll_curve = &default_scroll_curve;
+}
+
+void reset_keyboard(struct keyboard *kb)
+{
+    memset(kb->states, 0, sizeof(kb->states));
+    kb->queue_head = kb->queue_tail = 0;
+    kb->replay_time = 0;
+    kb->pending_x = kb->pending_y = 0;
+    kb->pending_scroll_x = kb->pending_scroll_y = 0;
+}
+
+void set_detectable_autorepeat(struct keyboard *kb, int detectable)
+{
+    kb->detectable_autorepeat = detectable;
+}
+
+void set_acceleration(struct keyboard *kb, const struct accel_curve *curve)
+{
+    kb->curve = curve;
+}
+
+void set_scroll_acceleration(struct keyboard *kb,
+                             const struct accel_curve *curve)
 {
-    mapping.up     = XKeysymToKeycode(display, XK_K);
-    mapping.down   = XKeysymToKeycode(display, XK_J);
-    mapping.left   = XKeysymToKeycode(display, XK_H);
-    mapping.right  = XKeysymToKeycode(display, XK_L);
+    kb->scroll_curve = curve;
+}
 
-    mapping.lclick = XKeysymToKeycode(display, XK_F);
-    mapping.mclick = XKeysymToKeycode(display, XK_D);
-    mapping.rclick = XKeysymToKeycode(display, XK_S);
+KeyCode binding_keycode(const struct keyboard *kb, enum binding binding)
+{
+    return kb->keycodes[binding];
 }
 
-static void process_move_event(struct key_state *key_state, int type)
+/*
+ * Compile bindings into the keycode table. Key states are indexed by binding,
+ * they survive a remapping.
+ */
+void set_keycodes(struct keyboard *kb, const KeyCode *keycodes)
 {
-    unsigned long time = current_milliseconds();
+    int i;
+
+    memset(kb->binding_table, BINDING_NONE, sizeof(kb->binding_table));
+
+    for (i = BINDING_NONE + 1; i < BINDING_COUNT; i++) {
+        kb->keycodes[i] = keycodes[i];
+        if (keycodes[i])
+            kb->binding_table[keycodes[i]] = i;
+    }
+}
 
+static void process_move_event(struct keyboard *kb,
+                               struct key_state *key_state, int type,
+                               unsigned long time)
+{
     // Update position
     if (type == KeyPress) {
+        // Detected autorepeat: the key is still down
+        if (key_state->position == POS_DOWN)
+            return;
+
         key_state->position = POS_DOWN;
 
         /*
@@ -91,105 +149,266 @@ static void process_move_event(struct key_state *key_state, int type)
          * E.g. if delta <= 10 milliseconds, this cannot be two real keystrokes:
          * this means user is maintaining the key pressed.
          */
-        if (key_state->release_time <= time - 10)
-            key_state->press_time = time;
+        if (!kb->detectable_autorepeat && key_state->release_time > time - 10)
+            return;
+
+        key_state->press_time = time;
+        key_state->stepped = 0;
+        key_state->moved_time = 0;
     } else if (type == KeyRelease) {
+        // Key was pressed before entering mouse mode: this release must not
+        // make a following press look like an autorepeat
+        if (key_state->position == POS_UP)
+            return;
+
         key_state->position = POS_UP;
         key_state->release_time = time;
     }
 }
 
-static void process_click_event(struct key_state *key_state, int type)
+/*
+ * Return whether the key event is a button edge to send: a press of a
+ * released key, or a release of a pressed key.
+ */
+static int process_click_event(struct keyboard *kb,
+                               struct key_state *key_state, int type)
 {
     if (type == KeyPress) {
-        if (key_state->pending == ACTION_NONE)
-            key_state->pending = ACTION_PRESS;
-        else if (key_state->pending == ACTION_RELEASE)
-            key_state->pending = ACTION_NONE;
-        else
-            printf("should not happen\n");
+        // Detected autorepeat: the button is already pressed
+        if (key_state->position == POS_DOWN)
+            return 0;
+        key_state->position = POS_DOWN;
     } else if (type == KeyRelease) {
-        if (key_state->pending == ACTION_NONE)
-            key_state->pending = ACTION_RELEASE;
-        else if (key_state->pending == ACTION_PRESS)
-            key_state->pending = ACTION_NONE;
-        else
-            printf("should not happen\n");
+        // Key was pressed before entering mouse mode
+        if (key_state->position == POS_UP)
+            return 0;
+        key_state->position = POS_UP;
+    }
+
+    if (key_state->button_down == (type == KeyPress)) {
+        printf("should not happen\n");
+        kb->anomalies++;
+        return 0;
+    }
+    key_state->button_down = type == KeyPress;
+
+    return 1;
+}
+
+void process_keyboard_event(struct keyboard *kb, int type, KeyCode keycode,
+                            unsigned long time)
+{
+    enum binding binding = keycode_binding(kb, keycode);
+    struct key_event *event;
+
+    switch (binding) {
+    case BINDING_UP:
+    case BINDING_DOWN:
+    case BINDING_LEFT:
+    case BINDING_RIGHT:
+    case BINDING_PRECISION:
+    case BINDING_LCLICK:
+    case BINDING_MCLICK:
+    case BINDING_RCLICK:
+    case BINDING_SCROLL_UP:
+    case BINDING_SCROLL_DOWN:
+    case BINDING_SCROLL_LEFT:
+    case BINDING_SCROLL_RIGHT:
+        break;
+    default:
+        return;
+    }
+
+    if (kb->queue_head - kb->queue_tail == KEY_EVENT_QUEUE_SIZE) {
+        fprintf(stderr, "Key event queue full, dropping event\n");
+        return;
     }
+
+    stats_count(STATS_KEY_EVENTS, 1);
+
+    event = &kb->queue[kb->queue_head++ % KEY_EVENT_QUEUE_SIZE];
+    event->time = time;
+    event->binding = binding;
+    event->type = type;
 }
 
-void process_keyboard_event(int type, KeyCode keycode)
+static int is_scrolling(const struct keyboard *kb)
 {
-    if (keycode == mapping.up)
-        process_move_event(&kb_state.up, type);
-    else if (keycode == mapping.down)
-        process_move_event(&kb_state.down, type);
-    else if (keycode == mapping.left)
-        process_move_event(&kb_state.left, type);
-    else if (keycode == mapping.right)
-        process_move_event(&kb_state.right, type);
-    else if (keycode == mapping.lclick)
-        process_click_event(&kb_state.lclick, type);
-    else if (keycode == mapping.mclick)
-        process_click_event(&kb_state.mclick, type);
-    else if (keycode == mapping.rclick)
-        process_click_event(&kb_state.rclick, type);
+    return kb->states[BINDING_SCROLL_UP].position == POS_DOWN ||
+           kb->states[BINDING_SCROLL_DOWN].position == POS_DOWN ||
+           kb->states[BINDING_SCROLL_LEFT].position == POS_DOWN ||
+           kb->states[BINDING_SCROLL_RIGHT].position == POS_DOWN;
 }
 
-int is_currently_moving_pointer()
+static int is_moving(const struct keyboard *kb)
 {
-    return kb_state.up.position == POS_DOWN ||
-           kb_state.down.position == POS_DOWN ||
-           kb_state.left.position == POS_DOWN ||
-           kb_state.right.position == POS_DOWN;
+    return kb->states[BINDING_UP].position == POS_DOWN ||
+           kb->states[BINDING_DOWN].position == POS_DOWN ||
+           kb->states[BINDING_LEFT].position == POS_DOWN ||
+           kb->states[BINDING_RIGHT].position == POS_DOWN;
 }
 
-static void compute_pointer_movement_for_key(unsigned long time,
-                                             struct key_state *key_state,
-                                             int base_x, int base_y,
-                                             int *dx, int *dy)
+int is_currently_moving_pointer(const struct keyboard *kb)
 {
-    static int delay = 200;
+    return is_moving(kb) || is_scrolling(kb);
+}
 
-    if (key_state->position == POS_DOWN) {
-        long delta = time - key_state->press_time;
-        if (delta >= delay || key_state->last_action_time <= time - delay) {
-            unsigned int speed = 1 + 0.2 * exp(0.005 * (delta - delay));
-            speed = speed < 32 ? speed : 32;
-            // printf("             speed = %u\n", speed);
+static double compute_pointer_movement_for_key(struct keyboard *kb,
+                                               const struct accel_curve *curve,
+                                               unsigned long time,
+                                               enum binding binding)
+{
+    struct key_state *key_state = &kb->states[binding];
+    unsigned long held, delay = curve->params.delay;
+    double distance;
 
-            *dx += speed * base_x;
-            *dy += speed * base_y;
+    if (key_state->position != POS_DOWN)
+        return 0;
 
-            key_state->last_action_time = time;
-        }
+    held = time - key_state->press_time;
+
+    // Move a bit as soon as the key is pressed, then wait for the delay
+    if (!key_state->stepped) {
+        key_state->stepped = 1;
+        key_state->moved_time = held;
+        return curve->params.step;
+    }
+    if (held <= delay) {
+        key_state->moved_time = held;
+        return 0;
     }
+
+    distance = accel_distance(curve, held - delay);
+    if (key_state->moved_time > delay)
+        distance -= accel_distance(curve, key_state->moved_time - delay);
+    key_state->moved_time = held;
+
+    if (kb->states[BINDING_PRECISION].position == POS_DOWN)
+        distance *= curve->params.precision_factor;
+
+    return distance;
+}
+
+static void integrate_movement(struct keyboard *kb, unsigned long time)
+{
+    // Never go back in time (server and local clocks may disagree a bit)
+    if (time < kb->replay_time)
+        time = kb->replay_time;
+    kb->replay_time = time;
+
+    kb->pending_x +=
+        compute_pointer_movement_for_key(kb, kb->curve, time, BINDING_RIGHT) -
+        compute_pointer_movement_for_key(kb, kb->curve, time, BINDING_LEFT);
+    kb->pending_y +=
+        compute_pointer_movement_for_key(kb, kb->curve, time, BINDING_DOWN) -
+        compute_pointer_movement_for_key(kb, kb->curve, time, BINDING_UP);
+
+    kb->pending_scroll_x +=
+        compute_pointer_movement_for_key(kb, kb->scroll_curve, time,
+                                         BINDING_SCROLL_RIGHT) -
+        compute_pointer_movement_for_key(kb, kb->scroll_curve, time,
+                                         BINDING_SCROLL_LEFT);
+    kb->pending_scroll_y +=
+        compute_pointer_movement_for_key(kb, kb->scroll_curve, time,
+                                         BINDING_SCROLL_DOWN) -
+        compute_pointer_movement_for_key(kb, kb->scroll_curve, time,
+                                         BINDING_SCROLL_UP);
+}
+
+// Only move by whole pixels, and keep the rest for next time
+static void take_pending_movement(struct keyboard *kb, int *dx, int *dy)
+{
+    *dx = (int) kb->pending_x;
+    *dy = (int) kb->pending_y;
+    kb->pending_x -= *dx;
+    kb->pending_y -= *dy;
 }
 
-void compute_pointer_movement(unsigned long time, int *dx, int *dy)
+/*
+ * Without detectable autorepeat, X tells that a key is maintained down with
+ * release-then-press pairs. If delta <= 10 milliseconds, this cannot be two
+ * real keystrokes.
+ */
+static int is_fake_release(const struct keyboard *kb,
+                           const struct key_event *event)
 {
-    compute_pointer_movement_for_key(time, &kb_state.up, 0, -1, dx, dy);
-    compute_pointer_movement_for_key(time, &kb_state.down, 0, 1, dx, dy);
-    compute_pointer_movement_for_key(time, &kb_state.left, -1, 0, dx, dy);
-    compute_pointer_movement_for_key(time, &kb_state.right, 1, 0, dx, dy);
+    const struct key_event *next;
+
+    if (kb->detectable_autorepeat || event->type != KeyRelease ||
+        kb->queue_head - kb->queue_tail < 2)
+        return 0;
+
+    next = &kb->queue[(kb->queue_tail + 1) % KEY_EVENT_QUEUE_SIZE];
+    return next->binding == event->binding && next->type == KeyPress &&
+           next->time <= event->time + 10;
 }
 
-static void compute_pointer_click_for_button(struct key_state *key_state,
-                                             int *press, int *release)
+int compute_pointer_clicks(struct keyboard *kb,
+                           struct pointer_click *clicks, int max)
 {
-    *press = key_state->pending == ACTION_PRESS;
-    *release = key_state->pending == ACTION_RELEASE;
-    key_state->pending = ACTION_NONE;
+    unsigned long time = kb->clock();
+    int n = 0;
+
+    while (kb->queue_tail != kb->queue_head && n < max) {
+        struct key_event *event =
+            &kb->queue[kb->queue_tail % KEY_EVENT_QUEUE_SIZE];
+        struct key_state *key_state = &kb->states[event->binding];
+
+        // Click keys only: movement keys handle it with their press time
+        if (event->binding >= BINDING_LCLICK &&
+            event->binding <= BINDING_RCLICK && is_fake_release(kb, event)) {
+            kb->queue_tail += 2;
+            continue;
+        }
+
+        integrate_movement(kb, event->time < time ? event->time : time);
+
+        switch (event->binding) {
+        case BINDING_LCLICK:
+        case BINDING_MCLICK:
+        case BINDING_RCLICK:
+            if (!process_click_event(kb, key_state, event->type))
+                break;
+            take_pending_movement(kb, &clicks[n].dx, &clicks[n].dy);
+            clicks[n].binding = event->binding;
+            clicks[n].press = event->type == KeyPress;
+            n++;
+            break;
+        default:
+            process_move_event(kb, key_state, event->type, event->time);
+            break;
+        }
+
+        kb->queue_tail++;
+    }
+
+    return n;
 }
 
-void compute_pointer_clicks(int *left_press, int *left_release,
-                            int *middle_press, int *middle_release,
-                            int *right_press, int *right_release)
+void compute_pointer_movement(struct keyboard *kb, int *dx, int *dy)
 {
-    compute_pointer_click_for_button(&kb_state.lclick,
-                                     left_press, left_release);
-    compute_pointer_click_for_button(&kb_state.mclick,
-                                     middle_press, middle_release);
-    compute_pointer_click_for_button(&kb_state.rclick,
-                                     right_press, right_release);
+    integrate_movement(kb, kb->clock());
+    take_pending_movement(kb, dx, dy);
+
+    // Do not keep fractions of pixels for the next move
+    if (!is_moving(kb)) {
+        kb->pending_x = 0;
+        kb->pending_y = 0;
+    }
+}
+
+void compute_scroll(struct keyboard *kb, double *dx, double *dy, int whole)
+{
+    integrate_movement(kb, kb->clock());
+
+    *dx = whole ? (int) kb->pending_scroll_x : kb->pending_scroll_x;
+    *dy = whole ? (int) kb->pending_scroll_y : kb->pending_scroll_y;
+    kb->pending_scroll_x -= *dx;
+    kb->pending_scroll_y -= *dy;
+
+    // Do not keep fractions of clicks for the next scroll
+    if (!is_scrolling(kb)) {
+        kb->pending_scroll_x = 0;
+        kb->pending_scroll_y = 0;
+    }
 }
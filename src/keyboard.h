@@ -21,6 +21,8 @@
 #include <time.h>
 #include <X11/Xlib.h>
 
+#include "accel.h"
+
 static inline unsigned long current_milliseconds()
 {
     struct timespec ts;
@@ -28,16 +30,178 @@ static inline unsigned long current_milliseconds()
     return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-void set_mapping(Display *display);
+static inline unsigned long current_microseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Actions that can be bound to keys, see keymap.h. Single keys are compiled
+ * into a keycode -> binding table by set_keycodes(), so that resolving a key
+ * event is a single indexed load.
+ */
+enum binding {
+    BINDING_NONE,
+
+    BINDING_UP,
+    BINDING_DOWN,
+    BINDING_LEFT,
+    BINDING_RIGHT,
+
+    BINDING_LCLICK,
+    BINDING_MCLICK,
+    BINDING_RCLICK,
+
+    BINDING_PRECISION,    /* slow down while held */
+
+    BINDING_MOUSE_MODE,   /* trigger, in normal mode */
+    BINDING_NORMAL_MODE,  /* leave mouse mode */
+
+    BINDING_JUMP,         /* enter or leave jump mode */
+
+    BINDING_PREV_MONITOR, /* jump to the center of the previous monitor */
+    BINDING_NEXT_MONITOR, /* jump to the center of the next monitor */
+
+    BINDING_SCROLL_UP,
+    BINDING_SCROLL_DOWN,
+    BINDING_SCROLL_LEFT,
+    BINDING_SCROLL_RIGHT,
+
+    BINDING_SNAP_UP,      /* to the next window edge or center above */
+    BINDING_SNAP_DOWN,
+    BINDING_SNAP_LEFT,
+    BINDING_SNAP_RIGHT,
+
+    BINDING_COUNT
+};
+
+/* Names of bindings, as in the config file ("up", "left-click"...) */
+extern const char *const binding_names[BINDING_COUNT];
+
+/* Return BINDING_NONE for an unknown name */
+enum binding binding_from_name(const char *name);
+
+struct key_state {
+    enum { POS_UP, POS_DOWN } position;
+
+    unsigned long press_time;
+    unsigned long release_time;
+
+    // For movement keys: initial step done, motion computed up to this time
+    int stepped;
+    unsigned long moved_time;
+
+    // For click keys: whether the button press was sent
+    int button_down;
+};
+
+/*
+ * Key events are queued with their timestamps and replayed in order by
+ * compute_pointer_clicks(), so that every edge becomes a button event and
+ * movement is integrated over the real key-down intervals, even when several
+ * events arrive between two ticks.
+ */
+#define KEY_EVENT_QUEUE_SIZE  128  /* power of two */
+
+struct key_event {
+    unsigned long time;
+    unsigned char binding;
+    unsigned char type;
+};
+
+/*
+ * State of the keyboard state machine. Members are private: use the
+ * functions below. Time is read from `clock`, in milliseconds.
+ */
+struct keyboard {
+    unsigned long (*clock)();
 
-void process_keyboard_event(int type, KeyCode keycode);
+    unsigned char binding_table[256];
+    KeyCode keycodes[BINDING_COUNT];
 
-int is_currently_moving_pointer();
+    struct key_state states[BINDING_COUNT];
 
-void compute_pointer_movement(unsigned long time, int *dx, int *dy);
+    // Shared between keyboards, see set_acceleration()
+    const struct accel_curve *curve;
+    const struct accel_curve *scroll_curve;  /* in wheel clicks */
 
-void compute_pointer_clicks(int *left_press, int *left_release,
-                            int *middle_press, int *middle_release,
-                            int *right_press, int *right_release);
+    // Whether X tells autorepeats apart, instead of faking release/press
+    int detectable_autorepeat;
+
+    struct key_event queue[KEY_EVENT_QUEUE_SIZE];
+    unsigned int queue_head, queue_tail;
+
+    // Events are replayed up to this time
+    unsigned long replay_time;
+
+    // Movement not sent yet, including fractions of pixels kept between ticks
+    double pending_x, pending_y;
+
+    // Same for scrolling, in wheel clicks
+    double pending_scroll_x, pending_scroll_y;
+
+    // Number of times an impossible state was reached (should stay 0)
+    unsigned long anomalies;
+};
+
+/*
+ * Initialize without bindings, with the default acceleration. `clock` can be
+ * NULL to use current_milliseconds().
+ */
+void keyboard_init(struct keyboard *kb, unsigned long (*clock)());
+
+/* Forget all key states and queued events */
+void reset_keyboard(struct keyboard *kb);
+
+static inline enum binding keycode_binding(const struct keyboard *kb,
+                                           KeyCode keycode)
+{
+    return kb->binding_table[keycode];
+}
+
+KeyCode binding_keycode(const struct keyboard *kb, enum binding binding);
+
+void set_keycodes(struct keyboard *kb, const KeyCode *keycodes);
+
+/*
+ * Curves are not copied: they must stay valid while the keyboard uses them,
+ * and can be shared by several keyboards.
+ */
+void set_acceleration(struct keyboard *kb, const struct accel_curve *curve);
+
+void set_scroll_acceleration(struct keyboard *kb,
+                             const struct accel_curve *curve);
+
+void set_detectable_autorepeat(struct keyboard *kb, int detectable);
+
+void process_keyboard_event(struct keyboard *kb, int type, KeyCode keycode,
+                            unsigned long time);
+
+/* Whether a movement or scroll key is held: ticks are needed */
+int is_currently_moving_pointer(const struct keyboard *kb);
+
+struct pointer_click {
+    int dx, dy;            /* movement to do before the click */
+    enum binding binding;  /* one of the click bindings */
+    int press;
+};
+
+/*
+ * Replay queued key events up to now, in order. Return the number of button
+ * edges stored in `clicks` (at most `max`): call again while it is `max`.
+ * Must be called before compute_pointer_movement().
+ */
+int compute_pointer_clicks(struct keyboard *kb,
+                           struct pointer_click *clicks, int max);
+
+void compute_pointer_movement(struct keyboard *kb, int *dx, int *dy);
+
+/*
+ * Scrolling up to now, in wheel clicks (positive is down and right). With
+ * `whole`, only whole clicks are returned and the rest is kept for later.
+ */
+void compute_scroll(struct keyboard *kb, double *dx, double *dy, int whole);
 
 #endif
@@ -0,0 +1,384 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keymap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xutil.h>
+#include <X11/keysym.h>
+
+#define KEY(keysym)  { { { keysym, 0 } }, 1 }
+#define KEYS(first, second)  { { { first, 0 }, { second, 0 } }, 2 }
+
+const struct key_sequence keymap_default_sequences[BINDING_COUNT] = {
+    [BINDING_UP]           = KEY(XK_K),
+    [BINDING_DOWN]         = KEY(XK_J),
+    [BINDING_LEFT]         = KEY(XK_H),
+    [BINDING_RIGHT]        = KEY(XK_L),
+
+    [BINDING_LCLICK]       = KEY(XK_F),
+    [BINDING_MCLICK]       = KEY(XK_D),
+    [BINDING_RCLICK]       = KEY(XK_S),
+
+    [BINDING_PRECISION]    = KEY(XK_Shift_L),
+
+    [BINDING_MOUSE_MODE]   = { { { XK_Alt_L, ControlMask | Mod4Mask } }, 1 },
+    [BINDING_NORMAL_MODE]  = KEY(XK_Escape),
+
+    [BINDING_JUMP]         = KEY(XK_semicolon),
+
+    [BINDING_PREV_MONITOR] = KEY(XK_bracketleft),
+    [BINDING_NEXT_MONITOR] = KEY(XK_bracketright),
+
+    [BINDING_SCROLL_UP]    = KEY(XK_U),
+    [BINDING_SCROLL_DOWN]  = KEY(XK_N),
+    [BINDING_SCROLL_LEFT]  = KEY(XK_comma),
+    [BINDING_SCROLL_RIGHT] = KEY(XK_period),
+
+    [BINDING_SNAP_UP]      = KEYS(XK_w, XK_k),
+    [BINDING_SNAP_DOWN]    = KEYS(XK_w, XK_j),
+    [BINDING_SNAP_LEFT]    = KEYS(XK_w, XK_h),
+    [BINDING_SNAP_RIGHT]   = KEYS(XK_w, XK_l)
+};
+
+static const struct {
+    const char *name;
+    unsigned int mask;
+} modifier_names[] = {
+    { "Shift", ShiftMask },
+    { "Ctrl", ControlMask },
+    { "Control", ControlMask },
+    { "Alt", Mod1Mask },
+    { "Super", Mod4Mask }
+};
+
+// Held for the next chord, they do not break a sequence
+static const KeySym modifier_keysyms[] = {
+    XK_Shift_L, XK_Shift_R, XK_Control_L, XK_Control_R,
+    XK_Alt_L, XK_Alt_R, XK_Super_L, XK_Super_R
+};
+
+static int parse_modifier(const char *name, size_t length,
+                          unsigned int *modifiers)
+{
+    int i;
+
+    for (i = 0; i < sizeof(modifier_names) / sizeof(modifier_names[0]); i++) {
+        if (strlen(modifier_names[i].name) == length &&
+            !strncmp(modifier_names[i].name, name, length)) {
+            *modifiers |= modifier_names[i].mask;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+int keymap_parse(const char *string, struct key_sequence *sequence)
+{
+    const char *end, *plus;
+    struct key_chord *chord;
+    char name[64];
+    size_t length;
+
+    memset(sequence, 0, sizeof(*sequence));
+
+    while (*string) {
+        if (*string == ' ') {
+            string++;
+            continue;
+        }
+        if (sequence->length == KEYMAP_MAX_CHORDS)
+            return -1;
+        chord = &sequence->chords[sequence->length++];
+        end = string + strcspn(string, " ");
+
+        // Modifiers, then the key
+        while ((plus = memchr(string, '+', end - string)) && plus + 1 < end) {
+            if (parse_modifier(string, plus - string, &chord->modifiers))
+                return -1;
+            string = plus + 1;
+        }
+
+        length = end - string;
+        if (length >= sizeof(name))
+            return -1;
+        memcpy(name, string, length);
+        name[length] = '\0';
+        chord->keysym = XStringToKeysym(name);
+        if (chord->keysym == NoSymbol)
+            return -1;
+
+        string = end;
+    }
+
+    return sequence->length ? 0 : -1;
+}
+
+/* "j" and "J" are on the same key */
+static int same_key(KeySym a, KeySym b)
+{
+    KeySym lower_a, lower_b, upper;
+
+    XConvertCase(a, &lower_a, &upper);
+    XConvertCase(b, &lower_b, &upper);
+    return lower_a == lower_b;
+}
+
+int keymap_conflict(const struct key_sequence *a,
+                    const struct key_sequence *b)
+{
+    int i;
+
+    if (!a->length || !b->length)
+        return 0;
+
+    for (i = 0; i < a->length && i < b->length; i++) {
+        if (!same_key(a->chords[i].keysym, b->chords[i].keysym))
+            return 0;
+        // One entry of the table, that cannot require both
+        if (a->chords[i].modifiers != b->chords[i].modifiers)
+            return 1;
+    }
+
+    return 1;
+}
+
+int keymap_plain(const struct key_sequence *sequence)
+{
+    return sequence->length == 1 && !sequence->chords[0].modifiers;
+}
+
+void keymap_init(struct keymap *keymap)
+{
+    memset(keymap, 0, sizeof(*keymap));
+    memcpy(keymap->sequences, keymap_default_sequences,
+           sizeof(keymap->sequences));
+}
+
+void keymap_free(struct keymap *keymap)
+{
+    free(keymap->table);
+    keymap->table = NULL;
+    keymap->n_states = 0;
+}
+
+void keymap_set_sequences(struct keymap *keymap,
+                          const struct key_sequence *sequences)
+{
+    memcpy(keymap->sequences, sequences, sizeof(keymap->sequences));
+}
+
+void keymap_reset(struct keymap *keymap)
+{
+    keymap->state = 0;
+    keymap->count = 0;
+}
+
+/* Return -1 if a key of the sequence has no keycode on this display */
+static int sequence_keycodes(Display *display,
+                             const struct key_sequence *sequence,
+                             KeyCode *keycodes)
+{
+    int i;
+
+    for (i = 0; i < sequence->length; i++) {
+        keycodes[i] = XKeysymToKeycode(display, sequence->chords[i].keysym);
+        if (!keycodes[i]) {
+            fprintf(stderr, "No keycode for keysym %s\n",
+                    XKeysymToString(sequence->chords[i].keysym));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Add a path from the root to `binding`, return -1 if a key is taken */
+static int add_sequence(struct keymap *keymap, enum binding binding,
+                        const KeyCode *keycodes)
+{
+    const struct key_sequence *sequence = &keymap->sequences[binding];
+    struct keymap_entry *entry;
+    int i, state = 0;
+
+    for (i = 0; i < sequence->length; i++) {
+        entry = &keymap->table[state][keycodes[i]];
+
+        if (i == sequence->length - 1) {
+            if (entry->kind != KEYMAP_NONE)
+                return -1;
+            entry->kind = KEYMAP_ACTION;
+            entry->value = binding;
+        } else if (entry->kind == KEYMAP_NONE) {
+            entry->kind = KEYMAP_PREFIX;
+            entry->value = keymap->n_states++;
+        } else if (entry->kind != KEYMAP_PREFIX ||
+                   entry->modifiers != sequence->chords[i].modifiers) {
+            return -1;
+        }
+        entry->modifiers = sequence->chords[i].modifiers;
+
+        state = entry->value;
+    }
+
+    return 0;
+}
+
+void keymap_compile(struct keymap *keymap, Display *display,
+                    KeyCode *keycodes)
+{
+    const struct key_sequence *sequence;
+    KeyCode sequence_codes[KEYMAP_MAX_CHORDS], keycode;
+    int i, n_states = 1;
+
+    // Each chord but the last can start a new state
+    for (i = BINDING_NONE + 1; i < BINDING_COUNT; i++)
+        if (keymap->sequences[i].length > 1)
+            n_states += keymap->sequences[i].length - 1;
+
+    free(keymap->table);
+    keymap->table = calloc(n_states, sizeof(*keymap->table));
+    if (!keymap->table) {
+        perror("calloc");
+        exit(1);
+    }
+    keymap->n_states = 1;
+    keymap_reset(keymap);
+
+    memset(keycodes, 0, BINDING_COUNT * sizeof(*keycodes));
+    memset(keymap->modifier_keys, 0, sizeof(keymap->modifier_keys));
+
+    keymap->trigger_modifiers =
+        keymap->sequences[BINDING_MOUSE_MODE].chords[0].modifiers;
+
+    for (i = BINDING_NONE + 1; i < BINDING_COUNT; i++) {
+        sequence = &keymap->sequences[i];
+        if (!sequence->length ||
+            sequence_keycodes(display, sequence, sequence_codes))
+            continue;
+
+        // The trigger is grabbed in normal mode only
+        if (i == BINDING_MOUSE_MODE) {
+            keycodes[i] = sequence_codes[0];
+            continue;
+        }
+
+        // Two keysyms of a sequence can be on the same key
+        if (add_sequence(keymap, i, sequence_codes)) {
+            fprintf(stderr, "Key of %s already bound, ignoring it\n",
+                    binding_names[i]);
+            continue;
+        }
+
+        if (keymap_plain(sequence))
+            keycodes[i] = sequence_codes[0];
+    }
+
+    // Unbound digits make counts
+    for (i = 0; i < 10; i++) {
+        keycode = XKeysymToKeycode(display, XK_0 + i);
+        if (keycode && keymap->table[0][keycode].kind == KEYMAP_NONE) {
+            keymap->table[0][keycode].kind = KEYMAP_DIGIT;
+            keymap->table[0][keycode].value = i;
+        }
+    }
+
+    for (i = 0; i < sizeof(modifier_keysyms) / sizeof(modifier_keysyms[0]);
+         i++) {
+        keycode = XKeysymToKeycode(display, modifier_keysyms[i]);
+        if (keycode)
+            keymap->modifier_keys[keycode] = 1;
+    }
+}
+
+static int entry_matches(const struct keymap_entry *entry,
+                         unsigned int modifiers)
+{
+    return entry->kind != KEYMAP_NONE &&
+           (modifiers & entry->modifiers) == entry->modifiers;
+}
+
+enum keymap_result keymap_press(struct keymap *keymap, KeyCode keycode,
+                                unsigned int modifiers,
+                                enum binding *binding, unsigned int *count)
+{
+    const struct keymap_entry *entry;
+
+    if (!keymap->table)
+        return KEYMAP_UNBOUND;
+
+    // Modifiers are pressed before the key of a chord: the sequence and
+    // count typed so far are kept
+    if (keymap->modifier_keys[keycode]) {
+        entry = &keymap->table[0][keycode];
+        if (entry->kind != KEYMAP_ACTION)
+            return KEYMAP_UNBOUND;
+        *binding = entry->value;
+        *count = 1;
+        return KEYMAP_MATCH;
+    }
+
+    // A key that does not continue the sequence starts a new one
+    entry = &keymap->table[keymap->state][keycode];
+    if (keymap->state && !entry_matches(entry, modifiers)) {
+        keymap_reset(keymap);
+        entry = &keymap->table[0][keycode];
+    }
+
+    if (entry_matches(entry, modifiers)) {
+        switch (entry->kind) {
+        case KEYMAP_DIGIT:
+            // Counts do not start with 0
+            if (!keymap->count && !entry->value)
+                break;
+            keymap->count = keymap->count * 10 + entry->value;
+            if (keymap->count > KEYMAP_MAX_COUNT)
+                keymap->count = KEYMAP_MAX_COUNT;
+            return KEYMAP_PENDING;
+        case KEYMAP_PREFIX:
+            keymap->state = entry->value;
+            return KEYMAP_PENDING;
+        case KEYMAP_ACTION:
+            *binding = entry->value;
+            *count = keymap->count ? keymap->count : 1;
+            keymap_reset(keymap);
+            return KEYMAP_MATCH;
+        }
+    }
+
+    keymap_reset(keymap);
+    return KEYMAP_UNBOUND;
+}
+
+int keymap_keycodes(const struct keymap *keymap, KeyCode *keycodes)
+{
+    int keycode, state, n = 0;
+
+    for (keycode = 1; keycode < 256; keycode++) {
+        for (state = 0; state < keymap->n_states; state++) {
+            if (keymap->table[state][keycode].kind != KEYMAP_NONE) {
+                keycodes[n++] = keycode;
+                break;
+            }
+        }
+    }
+
+    return n;
+}
@@ -0,0 +1,136 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _KEYMAP_H
+#define _KEYMAP_H
+
+#include <X11/Xlib.h>
+
+#include "keyboard.h"
+
+/*
+ * What a binding is bound to, as written in the config: chords separated by
+ * spaces, each one a key with optional modifiers.
+ *
+ *   "J"                 a single key
+ *   "Ctrl+Super+Alt_L"  a chord: Shift, Ctrl, Alt and Super are known
+ *   "g g"               a sequence
+ *
+ * In mouse mode, digits typed before a binding are a count: "5 J" moves 5
+ * steps down, "2 F" is a double click.
+ */
+#define KEYMAP_MAX_CHORDS  4
+#define KEYMAP_MAX_COUNT   999
+
+struct key_chord {
+    KeySym keysym;
+    unsigned int modifiers;  /* X masks, all must be down */
+};
+
+struct key_sequence {
+    struct key_chord chords[KEYMAP_MAX_CHORDS];
+    int length;  /* 0 if unbound */
+};
+
+extern const struct key_sequence keymap_default_sequences[BINDING_COUNT];
+
+/* Return -1 if `string` is not a valid sequence */
+int keymap_parse(const char *string, struct key_sequence *sequence);
+
+/* Whether one sequence is a prefix of the other: both cannot be bound */
+int keymap_conflict(const struct key_sequence *a,
+                    const struct key_sequence *b);
+
+/*
+ * Whether the binding is a single key without modifiers: the keyboard state
+ * machine handles it, while held. Others are taps, done on the last press.
+ */
+int keymap_plain(const struct key_sequence *sequence);
+
+/*
+ * Sequences are compiled into a transition table, indexed by state and
+ * keycode: a key press is resolved with one lookup, whatever the number of
+ * bindings. State 0 is the root, others are prefixes of sequences.
+ */
+enum keymap_kind {
+    KEYMAP_NONE,
+    KEYMAP_PREFIX,  /* `value` is the next state */
+    KEYMAP_ACTION,  /* `value` is the binding */
+    KEYMAP_DIGIT    /* `value` is the digit, in the root state only */
+};
+
+struct keymap_entry {
+    unsigned char kind;
+    unsigned char value;
+    unsigned char modifiers;
+};
+
+struct keymap {
+    struct key_sequence sequences[BINDING_COUNT];
+
+    struct keymap_entry (*table)[256];
+    int n_states;
+
+    // Modifiers of the mouse-mode chord, to grab in normal mode
+    unsigned int trigger_modifiers;
+
+    // Keycodes of Shift, Ctrl, Alt and Super
+    unsigned char modifier_keys[256];
+
+    // Sequence and count typed so far
+    int state;
+    unsigned int count;
+};
+
+enum keymap_result {
+    KEYMAP_UNBOUND,
+    KEYMAP_PENDING,  /* a prefix or a count: wait for the next key */
+    KEYMAP_MATCH
+};
+
+void keymap_init(struct keymap *keymap);
+
+void keymap_free(struct keymap *keymap);
+
+/* Sequences are copied, compiled by keymap_compile() */
+void keymap_set_sequences(struct keymap *keymap,
+                          const struct key_sequence *sequences);
+
+/*
+ * Compile sequences with the keycodes of `display`, and fill `keycodes` with
+ * those of the plain bindings (see keymap_plain()) and of the mouse-mode key,
+ * for the keyboard state machine. Like set_keycodes(), this is only done on
+ * startup, config change and MappingNotify.
+ */
+void keymap_compile(struct keymap *keymap, Display *display,
+                    KeyCode *keycodes);
+
+/* Forget the sequence and count typed so far */
+void keymap_reset(struct keymap *keymap);
+
+/*
+ * Resolve a key press. On a match, `binding` and `count` (at least 1) are
+ * set. A key that does not continue the pending sequence starts a new one.
+ */
+enum keymap_result keymap_press(struct keymap *keymap, KeyCode keycode,
+                                unsigned int modifiers,
+                                enum binding *binding, unsigned int *count);
+
+/* Fill `keycodes` (256 at most) with all keys used in mouse mode */
+int keymap_keycodes(const struct keymap *keymap, KeyCode *keycodes);
+
+#endif
@@ -0,0 +1,251 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "loop.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#define LOOP_MAX_SOURCES  256
+#define LOOP_MAX_EVENTS   8
+
+struct source {
+    int fd;
+    enum { SOURCE_FREE, SOURCE_FD, SOURCE_TIMER } type;
+    int armed;
+    int periodic;
+
+    loop_fd_callback fd_callback;
+    loop_timer_callback timer_callback;
+    void *data;
+};
+
+static int epoll_fd = -1;
+
+static struct source sources[LOOP_MAX_SOURCES];
+
+static loop_prepare_callback prepare_callback;
+static void *prepare_data;
+
+void loop_init()
+{
+    int i;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        exit(1);
+    }
+
+    for (i = 0; i < LOOP_MAX_SOURCES; i++)
+        sources[i].type = SOURCE_FREE;
+}
+
+static struct source *add_source(int fd)
+{
+    struct epoll_event ev = { .events = EPOLLIN };
+    int i;
+
+    for (i = 0; i < LOOP_MAX_SOURCES; i++)
+        if (sources[i].type == SOURCE_FREE)
+            break;
+    if (i == LOOP_MAX_SOURCES) {
+        fprintf(stderr, "Too many event loop sources\n");
+        exit(1);
+    }
+
+    // Keep the fd too, to ignore events of a source removed meanwhile
+    ev.data.u64 = (uint64_t) fd << 32 | i;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+
+    sources[i].fd = fd;
+    sources[i].armed = 0;
+    return &sources[i];
+}
+
+static struct source *find_source(int fd)
+{
+    int i;
+
+    for (i = 0; i < LOOP_MAX_SOURCES; i++)
+        if (sources[i].type != SOURCE_FREE && sources[i].fd == fd)
+            return &sources[i];
+
+    fprintf(stderr, "Unknown event loop source %d\n", fd);
+    exit(1);
+}
+
+static void remove_source(struct source *source)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+    source->type = SOURCE_FREE;
+}
+
+void loop_add_fd(int fd, loop_fd_callback callback, void *data)
+{
+    struct source *source = add_source(fd);
+
+    source->type = SOURCE_FD;
+    source->fd_callback = callback;
+    source->data = data;
+}
+
+void loop_remove_fd(int fd)
+{
+    remove_source(find_source(fd));
+}
+
+void loop_set_prepare(loop_prepare_callback callback, void *data)
+{
+    prepare_callback = callback;
+    prepare_data = data;
+}
+
+int loop_add_timer(loop_timer_callback callback, void *data)
+{
+    struct source *source;
+    int fd;
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        perror("timerfd_create");
+        exit(1);
+    }
+
+    source = add_source(fd);
+    source->type = SOURCE_TIMER;
+    source->timer_callback = callback;
+    source->data = data;
+
+    return fd;
+}
+
+void loop_remove_timer(int timer)
+{
+    remove_source(find_source(timer));
+    close(timer);
+}
+
+static void set_timespec(struct timespec *ts, unsigned long microseconds)
+{
+    ts->tv_sec = microseconds / 1000000;
+    ts->tv_nsec = (microseconds % 1000000) * 1000;
+}
+
+static void set_timer(int timer, unsigned long first, unsigned long period)
+{
+    struct source *source = find_source(timer);
+    struct itimerspec its;
+
+    set_timespec(&its.it_value, first);
+    set_timespec(&its.it_interval, period);
+
+    // A zero it_value would disarm the timer: make sure it is in the past
+    if (!first)
+        its.it_value.tv_nsec = 1;
+
+    if (timerfd_settime(timer, TFD_TIMER_ABSTIME, &its, NULL)) {
+        perror("timerfd_settime");
+        exit(1);
+    }
+
+    source->armed = 1;
+    source->periodic = period != 0;
+}
+
+void loop_set_periodic_timer(int timer, unsigned long first,
+                             unsigned long period)
+{
+    set_timer(timer, first, period);
+}
+
+void loop_set_oneshot_timer(int timer, unsigned long deadline)
+{
+    set_timer(timer, deadline, 0);
+}
+
+void loop_disarm_timer(int timer)
+{
+    struct source *source = find_source(timer);
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+    if (!source->armed)
+        return;
+
+    if (timerfd_settime(timer, 0, &its, NULL)) {
+        perror("timerfd_settime");
+        exit(1);
+    }
+
+    source->armed = 0;
+}
+
+int loop_timer_armed(int timer)
+{
+    return find_source(timer)->armed;
+}
+
+static void dispatch_timer(struct source *source)
+{
+    uint64_t expirations;
+
+    // Timer may have been disarmed by a previous callback of this round
+    if (read(source->fd, &expirations, sizeof(expirations)) !=
+        sizeof(expirations))
+        return;
+
+    if (!source->periodic)
+        source->armed = 0;
+
+    source->timer_callback(expirations, source->data);
+}
+
+void loop_run_once()
+{
+    struct epoll_event events[LOOP_MAX_EVENTS];
+    int n, i;
+
+    if (prepare_callback)
+        prepare_callback(prepare_data);
+
+    n = epoll_wait(epoll_fd, events, LOOP_MAX_EVENTS, -1);
+    if (n < 0) {
+        if (errno == EINTR)
+            return;
+        perror("epoll_wait");
+        exit(1);
+    }
+
+    for (i = 0; i < n; i++) {
+        struct source *source = &sources[events[i].data.u64 & 0xffffffff];
+
+        if (source->fd != (int) (events[i].data.u64 >> 32))
+            continue;
+        if (source->type == SOURCE_FD)
+            source->fd_callback(source->fd, source->data);
+        else if (source->type == SOURCE_TIMER)
+            dispatch_timer(source);
+    }
+}
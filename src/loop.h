@@ -0,0 +1,67 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LOOP_H
+#define _LOOP_H
+
+/*
+ * Single-threaded event loop built on epoll. File descriptors and timers
+ * (timerfd, CLOCK_MONOTONIC) are watched together, so input is handled as
+ * soon as it arrives and the loop sleeps when there is nothing to do.
+ *
+ * All times are absolute, in microseconds of CLOCK_MONOTONIC (the same clock
+ * as current_microseconds()): periods can follow refresh rates closely.
+ */
+
+typedef void (*loop_fd_callback)(int fd, void *data);
+typedef void (*loop_timer_callback)(unsigned long expirations, void *data);
+typedef void (*loop_prepare_callback)(void *data);
+
+void loop_init();
+
+void loop_add_fd(int fd, loop_fd_callback callback, void *data);
+
+void loop_remove_fd(int fd);
+
+/*
+ * Called before each blocking wait. Useful for libraries (like Xlib) that
+ * buffer input internally: the fd is not readable although events are
+ * already queued.
+ */
+void loop_set_prepare(loop_prepare_callback callback, void *data);
+
+int loop_add_timer(loop_timer_callback callback, void *data);
+
+void loop_remove_timer(int timer);
+
+/*
+ * Fire at `first`, then every `period` microseconds. Deadlines are absolute,
+ * so the period does not drift with the time spent in callbacks.
+ */
+void loop_set_periodic_timer(int timer, unsigned long first,
+                             unsigned long period);
+
+void loop_set_oneshot_timer(int timer, unsigned long deadline);
+
+void loop_disarm_timer(int timer);
+
+int loop_timer_armed(int timer);
+
+/* Wait for at least one event and dispatch all ready callbacks. */
+void loop_run_once();
+
+#endif
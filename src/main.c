@@ -17,273 +17,347 @@
 
 /*
  * TODO list:
- * - Read DISPLAY env var
- * - Check XTestQueryExtension on startup
- * - Configurable keys
- * - Configurable speed parameters
  * - Close cleanly on signal
- * - Timer 60 seconds to disable mouse mode if no button touched
  */
 
+#include <getopt.h>
+#include <signal.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/signalfd.h>
 #include <X11/Xlib.h>
-#include <X11/keysym.h>
 
 #include "config.h"
-#include "keyboard.h"
-#include "mouse.h"
+#include "control.h"
+#include "loop.h"
+#include "motion.h"
+#include "record.h"
+#include "session.h"
+#include "stats.h"
 
-#define DISPLAY ":0"
+static struct config config;
 
-static Display *display;
+// One per display, in config order
+static struct session *sessions;
 
-/*
- *  Mask        | Value | Key
- * -------------+-------+------------
- *  ShiftMask   |     1 | Shift
- *  LockMask    |     2 | Caps Lock
- *  ControlMask |     4 | Ctrl
- *  Mod1Mask    |     8 | Alt
- *  Mod2Mask    |    16 | Num Lock
- *  Mod3Mask    |    32 | Scroll Lock
- *  Mod4Mask    |    64 | Windows
- *  Mod5Mask    |   128 | ???
- */
+// uinput, evdev and the record are not tied to a display
+static int single_display;
 
-static void grab_key(int keycode, unsigned int modifiers)
-{
-    XGrabKey(display, keycode, modifiers, DefaultRootWindow(display),
-             True, GrabModeAsync, GrabModeAsync);
-    if (modifiers != AnyModifier)
-        XGrabKey(display, keycode, modifiers | Mod2Mask /* numlock */,
-                 DefaultRootWindow(display), True,
-                 GrabModeAsync, GrabModeAsync);
-}
-static void ungrab_key(int keycode, unsigned int modifiers)
-{
-    // XUngrabKey(display, keycode, AnyModifier, DefaultRootWindow(display));
-    XUngrabKey(display, keycode, modifiers, DefaultRootWindow(display));
-    if (modifiers != AnyModifier)
-        XUngrabKey(display, keycode, modifiers | Mod2Mask /* numlock */,
-                   DefaultRootWindow(display));
-}
+static const char *record_path;
+static int record_opened;
 
-static void enable_trigger_combination()
+static struct session *find_session(const char *name)
 {
-    unsigned int modifiers = ControlMask | Mod4Mask /* super */;
-    int keycode = XKeysymToKeycode(display, XK_Alt_L);
-
-    grab_key(keycode, modifiers);
-}
+    struct session *session;
 
-static void disable_trigger_combination()
-{
-    unsigned int modifiers = ControlMask | Mod4Mask /* super */;
-    int keycode = XKeysymToKeycode(display, XK_Alt_L);
+    for (session = sessions; session; session = session->next)
+        if (!strcmp(session->name, name))
+            return session;
 
-    ungrab_key(keycode, modifiers);
+    return NULL;
 }
 
-static int mouse_mode_combination_trigerred(XKeyPressedEvent *keyevent)
+static int display_wanted(const char *name)
 {
-    return keyevent->type == KeyRelease &&
-           keyevent->keycode == XKeysymToKeycode(display, XK_Alt_L);
-    // modifiers == ControlMask | Mod4Mask /* super */;
-}
-
-static int normal_mode_combination_trigerred(XKeyPressedEvent *keyevent)
-{
-    return keyevent->type == KeyRelease &&
-           keyevent->keycode == XKeysymToKeycode(display, XK_Escape);
-    // modifiers == ControlMask | Mod4Mask /* super */;
-}
+    int i;
 
-static void process_pointer_movement(unsigned long time)
-{
-    int dx = 0,
-        dy = 0;
+    if (!config.n_displays)
+        return !*name;
 
-    compute_pointer_movement(time, &dx, &dy);
+    for (i = 0; i < config.n_displays; i++)
+        if (!strcmp(config.displays[i], name))
+            return 1;
 
-    if (dx || dy) {
-        mouse_move(display, dx, dy);
-        // printf("moving %d %d\n", dx, dy);
-    }
+    return 0;
 }
 
-static void process_pointer_clicks()
+static void open_session(const char *name)
 {
-    int left_press, left_release,
-        middle_press, middle_release,
-        right_press, right_release;
-
-    compute_pointer_clicks(&left_press, &left_release,
-                           &middle_press, &middle_release,
-                           &right_press, &right_release);
-
-    if (left_press) {
-        mouse_press_button(display, MOUSE_LEFT_BUTTON);
-        printf("left click...\n");
-    } else if (left_release) {
-        mouse_release_button(display, MOUSE_LEFT_BUTTON);
-        printf("         release!\n");
-    }
+    struct session *session, **last;
 
-    if (middle_press) {
-        mouse_press_button(display, MOUSE_MIDDLE_BUTTON);
-        printf("middle click...\n");
-    } else if (middle_release) {
-        mouse_release_button(display, MOUSE_MIDDLE_BUTTON);
-        printf("         release!\n");
+    if (sessions && single_display) {
+        fprintf(stderr, "Not opening %s: uinput output, evdev input and "
+                "records only work with one display\n", name);
+        return;
     }
 
-    if (right_press) {
-        mouse_press_button(display, MOUSE_RIGHT_BUTTON);
-        printf("right click...\n");
-    } else if (right_release) {
-        mouse_release_button(display, MOUSE_RIGHT_BUTTON);
-        printf("         release!\n");
-    }
-}
-
-static int mouse_mode_on;
+    session = session_open(*name ? name : NULL, &config);
+    if (!session)
+        return;
 
-// #define GRAB_KEYS_NOT_KEYBOARD 1
+    for (last = &sessions; *last; last = &(*last)->next);
+    *last = session;
 
-static void grab_keyboard()
-{
-#ifdef GRAB_KEYS_NOT_KEYBOARD
-    int tab[] = { XK_Escape, XK_H, XK_J, XK_K, XK_L, XK_S, XK_D, XK_F };
-    int i;
-    for (i = 0; i < sizeof(tab)/sizeof(tab[0]); i++) {
-        grab_key(XKeysymToKeycode(display, tab[i]), AnyModifier);
+    if (record_path && !record_opened) {
+        if (record_open(record_path, session->detectable_autorepeat ?
+                        RECORD_DETECTABLE : 0))
+            exit(1);
+        record_opened = 1;
     }
-#else
-    // TODO: Check return value (== AlreadyGrabbed)
-    int ret = XGrabKeyboard(display, DefaultRootWindow(display),
-                            /*False, // */ True,
-                            /*GrabModeSync, GrabModeSync, // */
-                            GrabModeAsync, GrabModeAsync,
-                            CurrentTime);
-    if (ret) {
-        fprintf(stderr, "XGrabKeyboard returned %d\n", ret);
-        exit(1);
-    }
-#endif
+    if (record_opened)
+        session_record(session);
 }
 
-static void ungrab_keyboard()
+/*
+ * Close sessions of lost displays, and of displays no longer in the config.
+ * Then open the missing ones: a display that is down is retried on the next
+ * update.
+ */
+static void update_sessions()
 {
-#ifdef GRAB_KEYS_NOT_KEYBOARD
-    int tab[] = { XK_Escape, XK_H, XK_J, XK_K, XK_L, XK_S, XK_D, XK_F };
+    struct session **s, *session;
     int i;
-    for (i = 0; i < sizeof(tab)/sizeof(tab[0]); i++) {
-        ungrab_key(XKeysymToKeycode(display, tab[i]), AnyModifier);
+
+    for (s = &sessions; *s;) {
+        session = *s;
+        if (session->lost || !display_wanted(session->name)) {
+            *s = session->next;
+            session_close(session);
+        } else {
+            s = &session->next;
+        }
     }
-#else
-    XUngrabKeyboard(display, CurrentTime);
-#endif
+
+    if (!config.n_displays && !find_session(""))
+        open_session("");
+    for (i = 0; i < config.n_displays; i++)
+        if (!find_session(config.displays[i]))
+            open_session(config.displays[i]);
 }
 
-static void run_mouse_mode()
+static int on_control_command(const char *display,
+                              const struct control_command *command)
 {
-    mouse_mode_on = 1;
+    struct session *session = *display ? find_session(display) : sessions;
 
-    disable_trigger_combination();
+    if (!session || session->lost)
+        return -1;
 
-    grab_keyboard();
+    session_control(session, command);
+    return 0;
+}
 
-    // TODO: Do we need this?
-    // XTestGrabControl (display, True);
+static void on_control_batch()
+{
+    struct session *session;
 
-    while (mouse_mode_on) {
-        fd_set in_fds;
-        int x11_fd = ConnectionNumber(display);
+    for (session = sessions; session; session = session->next)
+        if (!session->lost)
+            session_control_flush(session);
+}
 
-        FD_ZERO(&in_fds);
-        FD_SET(x11_fd, &in_fds);
+static void on_loop_prepare(void *data)
+{
+    struct session **s, *session;
 
-        if (is_currently_moving_pointer()) {
-            // Sleep for 20 ms (50 Hz seems to be a good refresh rate).
-            usleep(20000);
+    for (s = &sessions; *s;) {
+        session = *s;
+        if (session->lost) {
+            *s = session->next;
+            session_close(session);
         } else {
-            // Sleep until an event arrives
-            select(x11_fd + 1, &in_fds, 0, 0, NULL);
-        }
-
-        // Get all X events before doing any pointer action
-        while (XPending(display)) {
-            XEvent event;
-
-            XNextEvent(display, &event);
-            XKeyPressedEvent *keyevent = (XKeyPressedEvent *) &event;
-            if (normal_mode_combination_trigerred(keyevent)) {
-                mouse_mode_on = 0;
-            }
-
-            process_keyboard_event(keyevent->type, keyevent->keycode);
+            session_prepare(session);
+            s = &session->next;
         }
+    }
+}
 
-        unsigned long time = current_milliseconds();
+/* Protocol errors (a grab on a window that went away...) are not fatal */
+static int on_x_error(Display *display, XErrorEvent *event)
+{
+    char text[256];
 
-        // Process KeyPress and KeyRelease here (and not before), because when
-        // a key is maintained down X sends many release-then-press events
-        process_pointer_clicks();
+    XGetErrorText(display, event->error_code, text, sizeof(text));
+    fprintf(stderr, "%s: X error: %s (request %d.%d)\n",
+            DisplayString(display), text, event->request_code,
+            event->minor_code);
+    return 0;
+}
 
-        process_pointer_movement(time);
-    }
+static void on_signal(int fd, void *data)
+{
+    struct signalfd_siginfo info;
 
-    ungrab_keyboard();
+    if (read(fd, &info, sizeof(info)) != sizeof(info))
+        return;
 
-    enable_trigger_combination();
+    if (info.ssi_signo == SIGUSR1)
+        stats_dump(stdout);
+    else if (info.ssi_signo == SIGHUP)
+        update_sessions();
 }
 
-static void run_normal_mode()
+/*
+ * The new config is already checked, so applying it cannot fail. Key states
+ * are indexed by binding: keys held down stay down.
+ */
+static void on_config_reload(const struct config *updated)
 {
-    while (1) {
-        XKeyPressedEvent event;
-        XNextEvent(display, (XEvent *) &event);
+    struct session *session;
 
-        if (mouse_mode_combination_trigerred(&event)) {
-            printf("=== Entering MOUSE mode (press escape to leave) ===\n");
+    for (session = sessions; session; session = session->next)
+        session_configure(session, updated);
 
-            run_mouse_mode();
+    // Displays added to or removed from the config
+    update_sessions();
+}
 
-            printf("=== Leaving MOUSE mode ===\n");
-        }
-    }
+static void usage(const char *name)
+{
+    printf("Usage: %s [OPTION]...\n"
+           "\n"
+           "  -c, --config FILE     read settings from FILE, default "
+           "~/.config/mousemode/\n"
+           "                        config.yml\n"
+           "  -i, --input BACKEND   read keys from BACKEND: x (default) or "
+           "evdev\n"
+           "  -m, --motion-thread   move the pointer from a dedicated "
+           "thread\n"
+           "  -R, --realtime        --motion-thread, with real-time "
+           "scheduling and\n"
+           "                        memory locked\n"
+           "  -o, --output BACKEND  send pointer actions through BACKEND: "
+           "x (default)\n"
+           "                        or uinput\n"
+           "  -p, --pointer NAME    drive master pointer NAME (created if "
+           "needed),\n"
+           "                        not the core pointer\n"
+           "  -r, --record FILE     record input sessions to FILE, see "
+           "mousemode-replay\n"
+           "  -s, --socket PATH     take pointer commands on the Unix socket "
+           "PATH\n"
+           "  -h, --help            show this help\n", name);
 }
 
 int main(int argc, char **argv)
 {
-    // read_config();
+    static const struct option options[] = {
+        { "config",        required_argument, NULL, 'c' },
+        { "input",         required_argument, NULL, 'i' },
+        { "motion-thread", no_argument,       NULL, 'm' },
+        { "realtime",      no_argument,       NULL, 'R' },
+        { "output",        required_argument, NULL, 'o' },
+        { "pointer",       required_argument, NULL, 'p' },
+        { "record",        required_argument, NULL, 'r' },
+        { "socket",        required_argument, NULL, 's' },
+        { "help",          no_argument,       NULL, 'h' },
+        { NULL,            0,                 NULL, 0 }
+    };
+    const char *output = NULL, *config_path = NULL, *socket_path = NULL;
+    const char *pointer = NULL;
+    struct session *session;
+    sigset_t signals;
+    int opt, optional, evdev_input = 0, threaded = 0, realtime = 0;
+
+    while ((opt = getopt_long(argc, argv, "c:i:mRo:p:r:s:h", options,
+                              NULL)) != -1) {
+        switch (opt) {
+        case 'c':
+            config_path = optarg;
+            break;
+        case 'i':
+            if (!strcmp(optarg, "evdev")) {
+                evdev_input = 1;
+            } else if (strcmp(optarg, "x")) {
+                fprintf(stderr, "Unknown input backend: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'm':
+            threaded = 1;
+            break;
+        case 'R':
+            threaded = realtime = 1;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'p':
+            pointer = optarg;
+            break;
+        case 'r':
+            record_path = optarg;
+            break;
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    // A bad config file is not fatal: defaults are used instead
+    config_defaults(&config);
+    optional = !config_path;
+    if (!config_path)
+        config_path = config_default_path();
+    if (config_load(&config, config_path, optional))
+        fprintf(stderr, "Using the default config\n");
+
+    // Before any other Xlib call: the motion thread sends requests too
+    if (threaded && !XInitThreads()) {
+        fprintf(stderr, "Cannot XInitThreads\n");
+        exit(1);
+    }
 
-    /*
-     * TODO: XSetErrorHandler(xerror_handler);
-     */
+    XSetErrorHandler(on_x_error);
 
-    display = XOpenDisplay(DISPLAY);
-    if (display == NULL) {
-        fprintf(stderr, "Cannot XOpenDisplay\n");
+    // uinput devices are attached to the core pointer
+    if (pointer && output && strcmp(output, "x")) {
+        fprintf(stderr, "A master pointer needs the x output\n");
         exit(1);
     }
 
-    set_mapping(display);
+    session_set_backends(output, evdev_input, pointer);
+    single_display = evdev_input || record_path ||
+                     (output && !strcmp(output, "uinput"));
 
-    enable_trigger_combination();
+    loop_init();
+    loop_set_prepare(on_loop_prepare, NULL);
 
-    // main loop
-    run_normal_mode();
+    // Dump statistics on SIGUSR1, reconnect displays on SIGHUP. Blocked
+    // before the motion thread starts, so that it inherits the mask: their
+    // default action would kill us if they went to that thread.
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGHUP);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+
+    if (threaded && motion_start(realtime))
+        exit(1);
 
-    disable_trigger_combination();
+    // Displays that are down at startup are retried on SIGHUP, but there
+    // must be at least one to start with
+    update_sessions();
+    if (!sessions)
+        exit(1);
 
-    if (XCloseDisplay(display)) {
-        fprintf(stderr, "Cannot XCloseDisplay\n");
+    if (socket_path &&
+        control_init(socket_path, on_control_command, on_control_batch))
         exit(1);
+
+    // Without a watch, config changes need a restart: not fatal either
+    config_watch(&config, config_path, on_config_reload);
+
+    loop_add_fd(signalfd(-1, &signals, SFD_CLOEXEC), on_signal, NULL);
+
+    // main loop
+    while (1)
+        loop_run_once();
+
+    while ((session = sessions)) {
+        sessions = session->next;
+        session_close(session);
     }
 
+    control_close();
+    record_close();
+
     return EXIT_SUCCESS;
 }
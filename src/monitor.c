@@ -0,0 +1,205 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "monitor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <X11/extensions/Xrandr.h>
+
+static int compare_monitors(const void *a, const void *b)
+{
+    const struct monitor *m = a, *n = b;
+
+    if (m->x != n->x)
+        return m->x - n->x;
+    return m->y - n->y;
+}
+
+/* Refresh rate (mHz) of the mode of an output, 0 if it is off */
+static unsigned int refresh_rate(Display *display,
+                                 XRRScreenResources *resources,
+                                 RROutput output)
+{
+    XRROutputInfo *output_info;
+    XRRCrtcInfo *crtc_info = NULL;
+    unsigned long lines;
+    unsigned int rate = 0;
+    int i;
+
+    output_info = XRRGetOutputInfo(display, resources, output);
+    if (output_info && output_info->crtc)
+        crtc_info = XRRGetCrtcInfo(display, resources, output_info->crtc);
+
+    for (i = 0; crtc_info && i < resources->nmode; i++) {
+        const XRRModeInfo *mode = &resources->modes[i];
+
+        if (mode->id != crtc_info->mode)
+            continue;
+
+        lines = mode->vTotal;
+        if (mode->modeFlags & RR_DoubleScan)
+            lines *= 2;
+        if (mode->modeFlags & RR_Interlace)
+            lines /= 2;
+        if (mode->hTotal && lines)
+            rate = (unsigned long long) mode->dotClock * 1000 /
+                   ((unsigned long long) mode->hTotal * lines);
+        break;
+    }
+
+    if (crtc_info)
+        XRRFreeCrtcInfo(crtc_info);
+    if (output_info)
+        XRRFreeOutputInfo(output_info);
+    return rate;
+}
+
+static void load_monitors(struct monitors *monitors)
+{
+    Display *display = monitors->display;
+    struct monitor *list = monitors->list;
+    XRRMonitorInfo *info = NULL;
+    XRRScreenResources *resources = NULL;
+    int i, n = 0;
+
+    if (monitors->randr_available) {
+        info = XRRGetMonitors(display, DefaultRootWindow(display), True, &n);
+        resources = XRRGetScreenResourcesCurrent(display,
+                                                 DefaultRootWindow(display));
+    }
+
+    monitors->count = 0;
+    for (i = 0; i < n && monitors->count < MONITOR_MAX; i++) {
+        struct monitor *m = &list[monitors->count++];
+
+        m->x = info[i].x;
+        m->y = info[i].y;
+        m->width = info[i].width;
+        m->height = info[i].height;
+
+        // Outputs of a monitor show the same picture: take the first one
+        m->refresh_rate = resources && info[i].noutput ?
+            refresh_rate(display, resources, info[i].outputs[0]) : 0;
+    }
+    if (resources)
+        XRRFreeScreenResources(resources);
+    if (info)
+        XRRFreeMonitors(info);
+
+    if (!monitors->count) {
+        list[0].x = list[0].y = 0;
+        list[0].width = DisplayWidth(display, DefaultScreen(display));
+        list[0].height = DisplayHeight(display, DefaultScreen(display));
+        list[0].refresh_rate = 0;
+        monitors->count = 1;
+    }
+
+    qsort(list, monitors->count, sizeof(list[0]), compare_monitors);
+}
+
+void monitor_init(struct monitors *monitors, Display *display)
+{
+    const struct monitor *m;
+    int i, error_base, major = 0, minor = 0;
+
+    monitors->display = display;
+
+    // Monitors appeared in RandR 1.5
+    monitors->randr_available =
+        XRRQueryExtension(display, &monitors->randr_event_base,
+                          &error_base) &&
+        XRRQueryVersion(display, &major, &minor) &&
+        (major > 1 || (major == 1 && minor >= 5));
+    // A mode change at the same size only changes the CRTC
+    if (monitors->randr_available)
+        XRRSelectInput(display, DefaultRootWindow(display),
+                       RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask);
+
+    load_monitors(monitors);
+
+    // Not on reloads: hotplugs and mode changes are silent
+    for (i = 0; i < monitors->count; i++) {
+        m = &monitors->list[i];
+        printf("%s: monitor %d: %dx%d+%d+%d, %.2f Hz\n",
+               DisplayString(display), i, m->width, m->height, m->x, m->y,
+               m->refresh_rate / 1000.);
+    }
+}
+
+int monitor_process_event(const struct monitors *monitors, XEvent *event,
+                          struct monitors *updated)
+{
+    if (!monitors->randr_available)
+        return 0;
+
+    if (event->type == monitors->randr_event_base + RRScreenChangeNotify) {
+        // Also updates DisplayWidth() and DisplayHeight()
+        XRRUpdateConfiguration(event);
+    } else if (event->type != monitors->randr_event_base + RRNotify) {
+        return 0;
+    }
+
+    *updated = *monitors;
+    load_monitors(updated);
+    return 1;
+}
+
+int monitor_count(const struct monitors *monitors)
+{
+    return monitors->count;
+}
+
+const struct monitor *monitor_get(const struct monitors *monitors, int i)
+{
+    return &monitors->list[i];
+}
+
+static int clamp(int value, int min, int max)
+{
+    return value < min ? min : value > max ? max : value;
+}
+
+int monitor_at(const struct monitors *monitors, int x, int y)
+{
+    long distance, best_distance = -1;
+    int i, best = 0, cx, cy;
+
+    for (i = 0; i < monitors->count; i++) {
+        const struct monitor *m = &monitors->list[i];
+
+        cx = clamp(x, m->x, m->x + m->width - 1);
+        cy = clamp(y, m->y, m->y + m->height - 1);
+        distance = (long) (cx - x) * (cx - x) + (long) (cy - y) * (cy - y);
+        if (!distance)
+            return i;
+        if (best_distance < 0 || distance < best_distance) {
+            best_distance = distance;
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+void monitor_clamp(const struct monitors *monitors, int *x, int *y)
+{
+    const struct monitor *m = &monitors->list[monitor_at(monitors, *x, *y)];
+
+    *x = clamp(*x, m->x, m->x + m->width - 1);
+    *y = clamp(*y, m->y, m->y + m->height - 1);
+}
@@ -0,0 +1,71 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MONITOR_H
+#define _MONITOR_H
+
+#include <X11/Xlib.h>
+
+/*
+ * Monitor geometry and refresh rate, from XRandR. It is queried once, then
+ * again only when the server sends RRScreenChangeNotify or a CRTC changes:
+ * lookups never talk to the server.
+ * Without XRandR, the whole screen is one monitor.
+ *
+ * Monitors are sorted left to right, then top to bottom.
+ */
+
+struct monitor {
+    int x, y;
+    int width, height;
+    unsigned int refresh_rate;  /* mHz, 0 if unknown */
+};
+
+#define MONITOR_MAX  16
+
+/* Monitors of a display. Members are private: use the functions below. */
+struct monitors {
+    Display *display;
+
+    int randr_available;
+    int randr_event_base;
+
+    struct monitor list[MONITOR_MAX];
+    int count;
+};
+
+void monitor_init(struct monitors *monitors, Display *display);
+
+/*
+ * Return whether `event` was a XRandR event, and fill `updated` with the new
+ * monitors. This makes round-trips: `monitors` is not touched, so that the
+ * motion thread can still read it meanwhile.
+ */
+int monitor_process_event(const struct monitors *monitors, XEvent *event,
+                          struct monitors *updated);
+
+int monitor_count(const struct monitors *monitors);
+
+const struct monitor *monitor_get(const struct monitors *monitors, int i);
+
+/* Index of the monitor containing (x, y), or the nearest one */
+int monitor_at(const struct monitors *monitors, int x, int y);
+
+/* Bring (x, y) to the nearest visible point, out of dead zones */
+void monitor_clamp(const struct monitors *monitors, int *x, int *y);
+
+#endif
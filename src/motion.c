@@ -0,0 +1,214 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "motion.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+
+// Above other real-time threads of a desktop (PulseAudio uses 5)
+#define PRIORITY  10
+
+// Locked in memory with all the rest: do not take the default 8 MB
+#define STACK_SIZE  (256 * 1024)
+
+struct client {
+    motion_callback callback;
+    void *data;  /* NULL if the slot is free */
+};
+
+static struct client clients[MOTION_MAX_CLIENTS];
+
+static pthread_mutex_t lock;
+static pthread_t thread;
+static int threaded;
+
+static int wake_fd = -1;
+static int timer_fd = -1;
+
+static void set_deadline(unsigned long deadline)
+{
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+    // Zero disarms: a deadline of 0 us can only be in the past anyway
+    its.it_value.tv_sec = deadline / 1000000;
+    its.it_value.tv_nsec = (deadline % 1000000) * 1000;
+
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+        perror("timerfd_settime");
+        exit(1);
+    }
+}
+
+static void *run(void *arg)
+{
+    struct pollfd fds[2] = {
+        { .fd = wake_fd, .events = POLLIN },
+        { .fd = timer_fd, .events = POLLIN }
+    };
+    unsigned long deadline, next;
+    uint64_t value;
+    int i;
+
+    while (1) {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+            perror("poll");
+            exit(1);
+        }
+
+        // Both are non-blocking: only reset them
+        if (read(wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+            perror("read");
+        if (read(timer_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+            perror("read");
+
+        next = 0;
+        motion_lock();
+        for (i = 0; i < MOTION_MAX_CLIENTS; i++) {
+            if (!clients[i].data)
+                continue;
+            deadline = clients[i].callback(clients[i].data);
+            if (deadline && (!next || deadline < next))
+                next = deadline;
+        }
+        motion_unlock();
+
+        set_deadline(next);
+    }
+
+    return NULL;
+}
+
+static void set_realtime()
+{
+    struct sched_param param = { .sched_priority = PRIORITY };
+    int ret;
+
+    // No page fault in the middle of a tick
+    if (mlockall(MCL_CURRENT | MCL_FUTURE))
+        perror("mlockall");
+
+    ret = pthread_setschedparam(thread, SCHED_FIFO, &param);
+    if (ret)
+        fprintf(stderr, "Cannot use SCHED_FIFO: %s\n", strerror(ret));
+}
+
+static void init_lock()
+{
+    static int initialized;
+    pthread_mutexattr_t attr;
+
+    if (initialized)
+        return;
+    initialized = 1;
+
+    // The main thread may hold the lock while the motion thread, with a
+    // higher priority, waits for it
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+int motion_start(int realtime)
+{
+    pthread_attr_t attr;
+    int ret;
+
+    init_lock();
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (wake_fd < 0 || timer_fd < 0) {
+        perror("motion_start");
+        return -1;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, STACK_SIZE);
+    ret = pthread_create(&thread, &attr, run, NULL);
+    pthread_attr_destroy(&attr);
+    if (ret) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+        return -1;
+    }
+    threaded = 1;
+
+    if (realtime)
+        set_realtime();
+
+    return 0;
+}
+
+int motion_threaded()
+{
+    return threaded;
+}
+
+void motion_lock()
+{
+    init_lock();
+    pthread_mutex_lock(&lock);
+}
+
+void motion_unlock()
+{
+    pthread_mutex_unlock(&lock);
+}
+
+void motion_add(motion_callback callback, void *data)
+{
+    int i;
+
+    for (i = 0; i < MOTION_MAX_CLIENTS; i++) {
+        if (!clients[i].data) {
+            clients[i].callback = callback;
+            clients[i].data = data;
+            return;
+        }
+    }
+
+    fprintf(stderr, "Too many motion clients\n");
+    exit(1);
+}
+
+void motion_remove(void *data)
+{
+    int i;
+
+    for (i = 0; i < MOTION_MAX_CLIENTS; i++)
+        if (clients[i].data == data)
+            clients[i].data = NULL;
+}
+
+void motion_wake()
+{
+    uint64_t value = 1;
+
+    if (threaded && write(wake_fd, &value, sizeof(value)) < 0)
+        perror("write");
+}
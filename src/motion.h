@@ -0,0 +1,57 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MOTION_H
+#define _MOTION_H
+
+/*
+ * Optional thread for pointer motion: it runs ticks on time, whatever the
+ * main thread is busy with (a burst of X events, a round-trip...). Key edges
+ * reach it through rings (see ring.h), everything else they share is under
+ * motion_lock().
+ *
+ * Without the thread, the lock is still taken: it is then never contended.
+ */
+#define MOTION_MAX_CLIENTS  64
+
+/*
+ * Called by the thread with the lock held, on each wakeup. Return the next
+ * deadline (us, see current_microseconds()), 0 for none.
+ */
+typedef unsigned long (*motion_callback)(void *data);
+
+/*
+ * Start the thread. With `realtime`, it is scheduled with SCHED_FIFO and all
+ * memory is locked, so that neither other processes nor page faults delay
+ * it: failing to do so is not fatal.
+ */
+int motion_start(int realtime);
+
+/* Whether the thread was started */
+int motion_threaded();
+
+void motion_lock();
+void motion_unlock();
+
+/* With the lock held */
+void motion_add(motion_callback callback, void *data);
+void motion_remove(void *data);
+
+/* Have the thread call all callbacks again, e.g. after pushing edges */
+void motion_wake();
+
+#endif
@@ -16,35 +16,364 @@
  */
 
 #include "mouse.h"
+#include "stats.h"
+#include "uinput.h"
 
-#include <X11/extensions/XTest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcbext.h>
+#include <xcb/xtest.h>
 
-void mouse_press_button(Display *display, unsigned int button)
+static int x_open(struct mouse *mouse)
 {
-    XTestFakeButtonEvent(display, button, True, CurrentTime);
+    const xcb_query_extension_reply_t *xtest;
+
+    xtest = xcb_get_extension_data(mouse->connection, &xcb_test_id);
+    mouse->stats.round_trips++;
+    if (!xtest || !xtest->present) {
+        fprintf(stderr, "XTest extension not available\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void x_press_button(struct mouse *mouse, unsigned int button)
+{
+    xcb_test_fake_input(mouse->connection, XCB_BUTTON_PRESS, button,
+                        XCB_CURRENT_TIME, XCB_NONE, 0, 0, 0);
+    mouse->stats.requests++;
+}
+
+static void x_release_button(struct mouse *mouse, unsigned int button)
+{
+    xcb_test_fake_input(mouse->connection, XCB_BUTTON_RELEASE, button,
+                        XCB_CURRENT_TIME, XCB_NONE, 0, 0, 0);
+    mouse->stats.requests++;
+}
+
+static void x_move(struct mouse *mouse, int dx, int dy)
+{
+    /*
+     * During a drag, many clients only follow motion from a device: a warp
+     * moves the pointer but their drag lags or fails. XTest motion goes
+     * through the XTest device. Relative XTest motion is accelerated by the
+     * server, like a real mouse: it is sent to the position we track
+     * instead, which already includes this move.
+     */
+    if (mouse->buttons_down) {
+        xcb_test_fake_input(mouse->connection, XCB_MOTION_NOTIFY,
+                            0 /* absolute */, XCB_CURRENT_TIME,
+                            DefaultRootWindow(mouse->display),
+                            mouse->pointer_x, mouse->pointer_y, 0);
+    } else {
+        // With no destination window, the server moves the pointer
+        // relatively to its current position: no need to query it first.
+        xcb_warp_pointer(mouse->connection, XCB_NONE, XCB_NONE, 0, 0, 0, 0,
+                         dx, dy);
+    }
+    mouse->stats.requests++;
+}
+
+// Pixels (Manhattan distance) of motion worth an event during a drag
+#define MIN_DRAG_MOTION  2
+
+// After a stall, do not flood the server: the rest is dropped
+#define MAX_WHEEL_CLICKS  16
+
+static void x_click_wheel(struct mouse *mouse, int clicks,
+                          unsigned int negative_button,
+                          unsigned int positive_button)
+{
+    unsigned int button = clicks < 0 ? negative_button : positive_button;
+    int i;
+
+    clicks = abs(clicks);
+    if (clicks > MAX_WHEEL_CLICKS)
+        clicks = MAX_WHEEL_CLICKS;
+
+    // Queued in XCB's buffer: all clicks of a tick go out in one write
+    for (i = 0; i < clicks; i++) {
+        x_press_button(mouse, button);
+        x_release_button(mouse, button);
+    }
+}
+
+static void x_scroll(struct mouse *mouse, double dx, double dy)
+{
+    x_click_wheel(mouse, dy, MOUSE_SCROLL_UP_BUTTON,
+                  MOUSE_SCROLL_DOWN_BUTTON);
+    x_click_wheel(mouse, dx, MOUSE_SCROLL_LEFT_BUTTON,
+                  MOUSE_SCROLL_RIGHT_BUTTON);
+}
+
+static int x_flush(struct mouse *mouse)
+{
+    xcb_flush(mouse->connection);
+    return 0;
+}
+
+/* The uinput device is not tied to a display: there is only one */
+
+static int u_open(struct mouse *mouse)
+{
+    // For absolute moves
+    if (x_open(mouse))
+        return -1;
+
+    return uinput_open();
+}
+
+static void u_press_button(struct mouse *mouse, unsigned int button)
+{
+    uinput_press_button(button);
+}
+
+static void u_release_button(struct mouse *mouse, unsigned int button)
+{
+    uinput_release_button(button);
+}
+
+static void u_move(struct mouse *mouse, int dx, int dy)
+{
+    uinput_move(dx, dy);
+}
+
+/*
+ * The server accelerates uinput motion: targets are reached with absolute
+ * XTest motion instead (a device motion, for drags). uinput events queued
+ * before go first, those queued after wait for the X flush.
+ */
+static void u_move_to(struct mouse *mouse, int x, int y)
+{
+    uinput_flush();
+    xcb_test_fake_input(mouse->connection, XCB_MOTION_NOTIFY,
+                        0 /* absolute */, XCB_CURRENT_TIME,
+                        DefaultRootWindow(mouse->display), x, y, 0);
+    mouse->stats.requests++;
+}
+
+static void u_scroll(struct mouse *mouse, double dx, double dy)
+{
+    uinput_scroll(dx, dy);
+}
+
+static int u_flush(struct mouse *mouse)
+{
+    xcb_flush(mouse->connection);
+    return uinput_flush();
+}
+
+static const struct mouse_backend backends[] = {
+    {
+        .name = "x",
+        .open = x_open,
+        .press_button = x_press_button,
+        .release_button = x_release_button,
+        .move = x_move,
+        .scroll = x_scroll,
+        .flush = x_flush
+    },
+    {
+        .name = "uinput",
+        .open = u_open,
+        .press_button = u_press_button,
+        .release_button = u_release_button,
+        .move = u_move,
+        .move_to = u_move_to,
+        .scroll = u_scroll,
+        .smooth_scroll = 1,
+        .flush = u_flush
+    }
+};
+
+int mouse_init(struct mouse *mouse, Display *display, const char *name,
+               const struct monitors *monitors)
+{
+    int i;
+
+    memset(mouse, 0, sizeof(*mouse));
+    mouse->display = display;
+    mouse->connection = XGetXCBConnection(display);
+    mouse->monitors = monitors;
+    mouse->backend = &backends[0];
+
+    if (name) {
+        mouse->backend = NULL;
+        for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+            if (!strcmp(backends[i].name, name))
+                mouse->backend = &backends[i];
+        if (!mouse->backend) {
+            fprintf(stderr, "Unknown output backend: %s\n", name);
+            return -1;
+        }
+    }
+
+    return mouse->backend->open(mouse);
+}
+
+static void send_motion(struct mouse *mouse)
+{
+    if (!mouse->motion_x && !mouse->motion_y)
+        return;
+
+    mouse->backend->move(mouse, mouse->motion_x, mouse->motion_y);
+    stats_count(STATS_MOVES, 1);
+
+    mouse->motion_x = mouse->motion_y = 0;
 }
 
-void mouse_release_button(Display *display, unsigned int button)
+void mouse_sync_position(struct mouse *mouse)
 {
-    XTestFakeButtonEvent(display, button, False, CurrentTime);
+    send_motion(mouse);
+
+    if (mouse->position_pending)
+        xcb_discard_reply(mouse->connection,
+                          mouse->position_cookie.sequence);
+
+    mouse->position_cookie =
+        xcb_query_pointer(mouse->connection,
+                          DefaultRootWindow(mouse->display));
+    mouse->position_pending = 1;
+    xcb_flush(mouse->connection);
+
+    mouse->stats.requests++;
 }
 
-void mouse_move(Display *display, int dx, int dy)
+static void collect_position(struct mouse *mouse)
 {
-    XEvent event;
+    xcb_query_pointer_reply_t *reply = NULL;
+    xcb_generic_error_t *error = NULL;
+
+    if (!mouse->position_pending)
+        return;
+    mouse->position_pending = 0;
 
-    /* Get the current pointer position */
-    XQueryPointer(display, RootWindow(display, 0),
-                  &event.xbutton.root, &event.xbutton.window,
-                  &event.xbutton.x_root, &event.xbutton.y_root,
-                  &event.xbutton.x, &event.xbutton.y,
-                  &event.xbutton.state);
+    // Only block if the reply did not arrive yet
+    if (!xcb_poll_for_reply(mouse->connection,
+                            mouse->position_cookie.sequence,
+                            (void **) &reply, &error)) {
+        reply = xcb_query_pointer_reply(mouse->connection,
+                                        mouse->position_cookie, &error);
+        mouse->stats.round_trips++;
+    }
 
-    // /* Fake the pointer movement to new relative position */
-    // XTestFakeMotionEvent(display, 0, event.xbutton.x + dx,
-    //         event.xbutton.y + dy, CurrentTime);
-    // XSync(display, False);
+    // Moves not sent yet are not in the reply
+    if (reply) {
+        mouse->pointer_x = reply->root_x + mouse->motion_x;
+        mouse->pointer_y = reply->root_y + mouse->motion_y;
+    }
+    free(reply);
+    free(error);
+}
+
+void mouse_get_position(struct mouse *mouse, int *x, int *y)
+{
+    collect_position(mouse);
 
-    XWarpPointer(display, None, event.xbutton.root, 0, 0, 0, 0,
-                 event.xbutton.x + dx, event.xbutton.y + dy);
+    *x = mouse->pointer_x;
+    *y = mouse->pointer_y;
+}
+
+/* Buttons go where the pointer was moved before: motion is sent first */
+void mouse_press_button(struct mouse *mouse, unsigned int button)
+{
+    send_motion(mouse);
+    mouse->backend->press_button(mouse, button);
+    stats_count(STATS_CLICKS, 1);
+
+    if (button < 256 && !mouse->button_down[button]) {
+        mouse->button_down[button] = 1;
+        mouse->buttons_down++;
+    }
+}
+
+void mouse_release_button(struct mouse *mouse, unsigned int button)
+{
+    send_motion(mouse);
+    mouse->backend->release_button(mouse, button);
+
+    if (button < 256 && mouse->button_down[button]) {
+        mouse->button_down[button] = 0;
+        mouse->buttons_down--;
+    }
+}
+
+void mouse_release_buttons(struct mouse *mouse)
+{
+    unsigned int button;
+
+    for (button = 0; button < 256 && mouse->buttons_down; button++)
+        if (mouse->button_down[button])
+            mouse_release_button(mouse, button);
+}
+
+void mouse_move(struct mouse *mouse, int dx, int dy)
+{
+    int x, y;
+
+    // Never send the pointer to a dead zone between monitors, nor let the
+    // server stop it at a screen border without us knowing
+    collect_position(mouse);
+    x = mouse->pointer_x + dx;
+    y = mouse->pointer_y + dy;
+    monitor_clamp(mouse->monitors, &x, &y);
+    mouse->motion_x += x - mouse->pointer_x;
+    mouse->motion_y += y - mouse->pointer_y;
+
+    mouse->pointer_x = x;
+    mouse->pointer_y = y;
+}
+
+void mouse_move_to(struct mouse *mouse, int x, int y)
+{
+    collect_position(mouse);
+
+    if (!mouse->backend->move_to) {
+        mouse_move(mouse, x - mouse->pointer_x, y - mouse->pointer_y);
+        return;
+    }
+
+    monitor_clamp(mouse->monitors, &x, &y);
+    mouse->backend->move_to(mouse, x, y);
+    stats_count(STATS_MOVES, 1);
+
+    mouse->motion_x = mouse->motion_y = 0;
+    mouse->pointer_x = x;
+    mouse->pointer_y = y;
+}
+
+int mouse_smooth_scroll(const struct mouse *mouse)
+{
+    return mouse->backend->smooth_scroll;
+}
+
+void mouse_scroll(struct mouse *mouse, double dx, double dy)
+{
+    send_motion(mouse);
+    mouse->backend->scroll(mouse, dx, dy);
+    stats_count(STATS_SCROLLS, 1);
+}
+
+void mouse_flush(struct mouse *mouse)
+{
+    // While dragging, a pixel of motion is noise to the client: it waits
+    // for more, or for the drop
+    if (!mouse->buttons_down ||
+        abs(mouse->motion_x) + abs(mouse->motion_y) >= MIN_DRAG_MOTION)
+        send_motion(mouse);
+
+    mouse->stats.requests += mouse->backend->flush(mouse);
+    mouse->stats.flushes++;
+}
+
+const struct mouse_stats *mouse_get_stats(const struct mouse *mouse)
+{
+    return &mouse->stats;
+}
+
+void mouse_reset_stats(struct mouse *mouse)
+{
+    memset(&mouse->stats, 0, sizeof(mouse->stats));
 }
@@ -19,15 +19,131 @@
 #define _MOUSE_H
 
 #include <X11/Xlib.h>
+#include <xcb/xcb.h>
+
+#include "monitor.h"
 
 #define MOUSE_LEFT_BUTTON    1
 #define MOUSE_MIDDLE_BUTTON  2
 #define MOUSE_RIGHT_BUTTON   3
 
-void mouse_press_button(Display *display, unsigned int button);
+// Core X protocol wheel: one press and release per click
+#define MOUSE_SCROLL_UP_BUTTON     4
+#define MOUSE_SCROLL_DOWN_BUTTON   5
+#define MOUSE_SCROLL_LEFT_BUTTON   6
+#define MOUSE_SCROLL_RIGHT_BUTTON  7
+
+struct mouse_stats {
+    unsigned long requests;
+    unsigned long round_trips;
+    unsigned long flushes;
+};
+
+struct mouse;
+
+/*
+ * Output backends: how pointer actions reach the system. "x", the default,
+ * sends X requests. "uinput" writes events to a virtual input device: no X
+ * requests nor display lock for actions but moves to a target, though the
+ * display is still used for keys, monitors and the pointer position.
+ */
+struct mouse_backend {
+    const char *name;
+
+    int (*open)(struct mouse *mouse);
+
+    // Actions may be buffered until flush(). Moves are coalesced before
+    // they get here: one per flush or button event, with pointer_x and
+    // pointer_y already at the destination.
+    void (*press_button)(struct mouse *mouse, unsigned int button);
+    void (*release_button)(struct mouse *mouse, unsigned int button);
+    void (*move)(struct mouse *mouse, int dx, int dy);
+
+    // To root coordinates, if relative moves do not land where asked
+    // (accelerated by the server): NULL otherwise
+    void (*move_to)(struct mouse *mouse, int x, int y);
+
+    // In wheel clicks, positive is down and right. Unless `smooth_scroll`,
+    // only whole clicks are given.
+    void (*scroll)(struct mouse *mouse, double dx, double dy);
+    int smooth_scroll;
+
+    // Return the number of requests sent
+    int (*flush)(struct mouse *mouse);
+};
+
+/* Pointer of a display. Members are private: use the functions below. */
+struct mouse {
+    Display *display;
+    const struct mouse_backend *backend;
+
+    /*
+     * The X backend sends its requests with XCB, on the connection of the
+     * Xlib display: they are queued without taking the Xlib display lock,
+     * and XCB keeps them ordered with Xlib's own requests.
+     */
+    xcb_connection_t *connection;
+
+    // Moves are clamped to these
+    const struct monitors *monitors;
+
+    /*
+     * Pointer position as known locally. It is only fetched from the server
+     * on mouse_sync_position(), when entering mouse mode and whenever
+     * something else moved the pointer, then kept up to date from our own
+     * moves.
+     */
+    int pointer_x, pointer_y;
+
+    // The reply is only read when the position is needed, usually long after
+    // it has arrived: no round-trip.
+    xcb_query_pointer_cookie_t position_cookie;
+    int position_pending;
+
+    // Buttons pressed by us: while one is, the pointer is dragging
+    unsigned char button_down[256];
+    int buttons_down;
+
+    // Moves not sent yet, already counted in pointer_x and pointer_y
+    int motion_x, motion_y;
+
+    struct mouse_stats stats;
+};
+
+/* Select the backend by name, NULL for the default one */
+int mouse_init(struct mouse *mouse, Display *display, const char *backend,
+               const struct monitors *monitors);
+
+/* Query the position again: the reply is only read when next needed */
+void mouse_sync_position(struct mouse *mouse);
+
+void mouse_get_position(struct mouse *mouse, int *x, int *y);
+
+void mouse_press_button(struct mouse *mouse, unsigned int button);
+
+void mouse_release_button(struct mouse *mouse, unsigned int button);
+
+/* Those pressed by us and not released yet */
+void mouse_release_buttons(struct mouse *mouse);
+
+/*
+ * Moves are summed until the next button event or flush: a tick sends one
+ * motion, whatever the number of keys held.
+ */
+void mouse_move(struct mouse *mouse, int dx, int dy);
+
+/* To a target (jump, monitor, snap): replaces moves not sent yet */
+void mouse_move_to(struct mouse *mouse, int x, int y);
+
+/* Whether mouse_scroll() takes fractions of wheel clicks */
+int mouse_smooth_scroll(const struct mouse *mouse);
+
+void mouse_scroll(struct mouse *mouse, double dx, double dy);
+
+void mouse_flush(struct mouse *mouse);
 
-void mouse_release_button(Display *display, unsigned int button);
+const struct mouse_stats *mouse_get_stats(const struct mouse *mouse);
 
-void mouse_move(Display *display, int dx, int dy);
+void mouse_reset_stats(struct mouse *mouse);
 
 #endif
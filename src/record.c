@@ -0,0 +1,247 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "record.h"
+
+#include <limits.h>
+#include <string.h>
+
+#define MAGIC  "MMREC2"
+
+static FILE *file;
+static unsigned long last_time;
+
+int record_open(const char *path, int flags)
+{
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    fwrite(MAGIC, 1, strlen(MAGIC), file);
+    fputc(flags, file);
+    last_time = 0;
+
+    return 0;
+}
+
+static void write_varint(unsigned long value)
+{
+    while (value >= 0x80) {
+        fputc((value & 0x7f) | 0x80, file);
+        value >>= 7;
+    }
+    fputc(value, file);
+}
+
+static void write_header(enum record_type type, unsigned long time)
+{
+    // Times may be a bit out of order (server vs. local clocks): they are
+    // kept as they are, for the replay to see the same
+    long delta = time - last_time;
+
+    fputc(type, file);
+    write_varint(((unsigned long) delta << 1) ^ (delta < 0 ? ~0UL : 0));
+    last_time = time;
+}
+
+void record_write(enum record_type type, unsigned long time,
+                  KeyCode keycode)
+{
+    if (!file)
+        return;
+
+    write_header(type, time);
+    if (type == RECORD_KEY_PRESS || type == RECORD_KEY_RELEASE)
+        fputc(keycode, file);
+}
+
+void record_write_mapping(unsigned long time, const KeyCode *keycodes, int n)
+{
+    if (!file)
+        return;
+
+    write_header(RECORD_MAPPING, time);
+    fputc(n, file);
+    fwrite(keycodes, 1, n, file);
+}
+
+static void write_double(double value)
+{
+    fwrite(&value, sizeof(value), 1, file);
+}
+
+void record_write_accel(enum record_type type, unsigned long time,
+                        const struct accel_params *params)
+{
+    unsigned int i;
+
+    if (!file)
+        return;
+
+    write_header(type, time);
+    fputc(params->profile, file);
+    write_varint(params->delay);
+    write_double(params->step);
+    write_double(params->base_speed);
+    write_double(params->max_speed);
+    write_varint(params->ramp);
+    write_double(params->precision_factor);
+    fputc(params->n_points, file);
+    for (i = 0; i < params->n_points; i++) {
+        write_varint(params->points[i].time);
+        write_double(params->points[i].speed);
+    }
+}
+
+void record_flush()
+{
+    if (file)
+        fflush(file);
+}
+
+void record_close()
+{
+    if (file)
+        fclose(file);
+    file = NULL;
+}
+
+int record_reader_open(struct record_reader *reader, const char *path)
+{
+    char magic[sizeof(MAGIC) - 1];
+
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    if (fread(magic, 1, sizeof(magic), reader->file) != sizeof(magic) ||
+        memcmp(magic, MAGIC, sizeof(magic)) ||
+        (reader->flags = fgetc(reader->file)) == EOF) {
+        fprintf(stderr, "%s: not a mousemode record\n", path);
+        fclose(reader->file);
+        return -1;
+    }
+
+    reader->time = 0;
+    return 0;
+}
+
+static int read_varint(FILE *f, unsigned long *value)
+{
+    int c, shift = 0;
+
+    *value = 0;
+    do {
+        if ((c = fgetc(f)) == EOF || shift > 56)
+            return -1;
+        *value |= (unsigned long) (c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    return 0;
+}
+
+static int read_double(FILE *f, double *value)
+{
+    return fread(value, sizeof(*value), 1, f) == 1 ? 0 : -1;
+}
+
+static int read_accel(FILE *f, struct accel_params *params)
+{
+    unsigned long value;
+    unsigned int i;
+    int c;
+
+    if ((c = fgetc(f)) == EOF || c > ACCEL_CUSTOM)
+        return -1;
+    params->profile = c;
+
+    if (read_varint(f, &value) || value > UINT_MAX)
+        return -1;
+    params->delay = value;
+
+    if (read_double(f, &params->step) ||
+        read_double(f, &params->base_speed) ||
+        read_double(f, &params->max_speed) ||
+        read_varint(f, &value) || value > UINT_MAX)
+        return -1;
+    params->ramp = value;
+
+    if (read_double(f, &params->precision_factor) ||
+        (c = fgetc(f)) == EOF || c > ACCEL_MAX_POINTS)
+        return -1;
+    params->n_points = c;
+
+    for (i = 0; i < params->n_points; i++) {
+        if (read_varint(f, &value) || value > UINT_MAX ||
+            read_double(f, &params->points[i].speed))
+            return -1;
+        params->points[i].time = value;
+    }
+
+    return 0;
+}
+
+int record_read(struct record_reader *reader, struct record *record)
+{
+    unsigned long zigzag;
+    int c;
+
+    if ((c = fgetc(reader->file)) == EOF)
+        return 0;
+
+    if (c < RECORD_KEY_PRESS || c > RECORD_SCROLL_ACCEL ||
+        read_varint(reader->file, &zigzag))
+        return -1;
+
+    record->type = c;
+    reader->time += (zigzag >> 1) ^ -(zigzag & 1);
+    record->time = reader->time;
+
+    switch (record->type) {
+    case RECORD_KEY_PRESS:
+    case RECORD_KEY_RELEASE:
+        if ((c = fgetc(reader->file)) == EOF)
+            return -1;
+        record->keycode = c;
+        break;
+    case RECORD_MAPPING:
+        if ((c = fgetc(reader->file)) == EOF || c > RECORD_MAX_BINDINGS ||
+            fread(record->keycodes, 1, c, reader->file) != c)
+            return -1;
+        record->n_keycodes = c;
+        break;
+    case RECORD_ACCEL:
+    case RECORD_SCROLL_ACCEL:
+        if (read_accel(reader->file, &record->accel))
+            return -1;
+        break;
+    default:
+        break;
+    }
+
+    return 1;
+}
+
+void record_reader_close(struct record_reader *reader)
+{
+    fclose(reader->file);
+}
@@ -0,0 +1,95 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RECORD_H
+#define _RECORD_H
+
+#include <stdio.h>
+#include <X11/Xlib.h>
+
+#include "accel.h"
+
+/*
+ * Binary log of input sessions, to replay them without any X server.
+ *
+ * File format: the "MMREC2" magic, one flags byte (RECORD_DETECTABLE), then
+ * records. A record is one type byte, the time elapsed since the previous
+ * record in milliseconds (zigzag LEB128 varint: server timestamps may be a
+ * bit out of order), then for key records the keycode, for mapping records
+ * the number of bindings and their keycodes, and for acceleration records the
+ * `accel_params` fields in order (enums and counts as one byte, times as
+ * varints, speeds as native doubles: records are replayed on the machine that
+ * made them).
+ */
+
+enum record_type {
+    RECORD_KEY_PRESS = 1,
+    RECORD_KEY_RELEASE,
+    RECORD_BATCH,       /* all queued X events were processed */
+    RECORD_TICK,
+    RECORD_ENTER,       /* mouse mode */
+    RECORD_LEAVE,
+    RECORD_MAPPING,     /* keycodes of bindings */
+    RECORD_ACCEL,       /* pointer acceleration, on start and config reload */
+    RECORD_SCROLL_ACCEL
+};
+
+#define RECORD_DETECTABLE  1  /* detectable autorepeat */
+
+#define RECORD_MAX_BINDINGS  64
+
+struct record {
+    enum record_type type;
+    unsigned long time;
+    KeyCode keycode;
+
+    int n_keycodes;
+    KeyCode keycodes[RECORD_MAX_BINDINGS];
+
+    struct accel_params accel;
+};
+
+int record_open(const char *path, int flags);
+
+void record_write(enum record_type type, unsigned long time,
+                  KeyCode keycode);
+
+void record_write_mapping(unsigned long time, const KeyCode *keycodes, int n);
+
+void record_write_accel(enum record_type type, unsigned long time,
+                        const struct accel_params *params);
+
+void record_flush();
+
+void record_close();
+
+/* Reading side */
+
+struct record_reader {
+    FILE *file;
+    int flags;
+    unsigned long time;
+};
+
+int record_reader_open(struct record_reader *reader, const char *path);
+
+/* Return 1 if a record was read, 0 at end of file, -1 on error */
+int record_read(struct record_reader *reader, struct record *record);
+
+void record_reader_close(struct record_reader *reader);
+
+#endif
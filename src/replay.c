@@ -0,0 +1,224 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Replay sessions recorded with `mousemode --record` through the keyboard
+ * state machine, without any X server. For each file, print a summary of the
+ * resulting pointer actions (and every action with -v), so that outputs can
+ * be compared between two versions of the motion model.
+ *
+ * Acceleration curves are rebuilt from the parameters in the record (the
+ * defaults before the first acceleration record). Not modeled: clamping to
+ * monitors, jump and snap, so positions are relative and may go off screen.
+ *
+ * Usage: mousemode-replay [-v] FILE...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "keyboard.h"
+#include "record.h"
+
+struct summary {
+    unsigned long records;
+    unsigned long moves;
+    long x, y;
+    unsigned long path;
+    long scroll_x, scroll_y;
+    unsigned long presses;
+    unsigned long releases;
+};
+
+static int verbose;
+
+static struct keyboard keyboard;
+
+static struct accel_curve curve, scroll_curve;
+
+static unsigned long replay_clock;
+
+static unsigned long replay_milliseconds()
+{
+    return replay_clock;
+}
+
+static void move(struct summary *summary, unsigned long time, int dx, int dy)
+{
+    if (!dx && !dy)
+        return;
+
+    summary->moves++;
+    summary->x += dx;
+    summary->y += dy;
+    summary->path += abs(dx) + abs(dy);
+
+    if (verbose)
+        printf("%lu move %d %d\n", time, dx, dy);
+}
+
+static void clicks(struct summary *summary, unsigned long time)
+{
+    struct pointer_click clicks[16];
+    int n, i;
+
+    do {
+        n = compute_pointer_clicks(&keyboard, clicks, 16);
+
+        for (i = 0; i < n; i++) {
+            move(summary, time, clicks[i].dx, clicks[i].dy);
+
+            if (clicks[i].press)
+                summary->presses++;
+            else
+                summary->releases++;
+
+            if (verbose)
+                printf("%lu %s %d\n", time,
+                       clicks[i].press ? "press" : "release",
+                       clicks[i].binding);
+        }
+    } while (n == 16);
+}
+
+static void movement(struct summary *summary, unsigned long time)
+{
+    int dx = 0, dy = 0;
+    double scroll_x, scroll_y;
+
+    compute_pointer_movement(&keyboard, &dx, &dy);
+    move(summary, time, dx, dy);
+
+    // As with the X output: whole wheel clicks
+    compute_scroll(&keyboard, &scroll_x, &scroll_y, 1);
+    summary->scroll_x += scroll_x;
+    summary->scroll_y += scroll_y;
+    if (verbose && (scroll_x || scroll_y))
+        printf("%lu scroll %.0f %.0f\n", time, scroll_x, scroll_y);
+}
+
+/* Same sequence of calls as in session.c */
+static int replay_record(struct summary *summary, struct record *record)
+{
+    KeyCode keycodes[BINDING_COUNT] = { 0 };
+
+    replay_clock = record->time;
+
+    switch (record->type) {
+    case RECORD_KEY_PRESS:
+    case RECORD_KEY_RELEASE:
+        process_keyboard_event(&keyboard, record->type == RECORD_KEY_PRESS ?
+                               KeyPress : KeyRelease,
+                               record->keycode, record->time);
+        break;
+    case RECORD_BATCH:
+        clicks(summary, record->time);
+        if (!is_currently_moving_pointer(&keyboard))
+            movement(summary, record->time);
+        break;
+    case RECORD_TICK:
+        clicks(summary, record->time);
+        movement(summary, record->time);
+        break;
+    case RECORD_MAPPING:
+        memcpy(keycodes, record->keycodes,
+               record->n_keycodes < BINDING_COUNT ?
+               record->n_keycodes : BINDING_COUNT);
+        set_keycodes(&keyboard, keycodes);
+        break;
+    case RECORD_ACCEL:
+        if (accel_build(&curve, &record->accel))
+            return -1;
+        set_acceleration(&keyboard, &curve);
+        break;
+    case RECORD_SCROLL_ACCEL:
+        if (accel_build(&scroll_curve, &record->accel))
+            return -1;
+        set_scroll_acceleration(&keyboard, &scroll_curve);
+        break;
+    case RECORD_LEAVE:
+        reset_keyboard(&keyboard);
+        if (verbose)
+            printf("%lu leave\n", record->time);
+        break;
+    default:
+        if (verbose)
+            printf("%lu enter\n", record->time);
+        break;
+    }
+
+    return 0;
+}
+
+static int replay(const char *path)
+{
+    struct record_reader reader;
+    struct summary summary;
+    struct record record;
+    int ret;
+
+    if (record_reader_open(&reader, path))
+        return -1;
+
+    memset(&summary, 0, sizeof(summary));
+    keyboard_init(&keyboard, replay_milliseconds);
+    set_detectable_autorepeat(&keyboard, reader.flags & RECORD_DETECTABLE);
+
+    while ((ret = record_read(&reader, &record)) > 0) {
+        if (replay_record(&summary, &record)) {
+            ret = -1;
+            break;
+        }
+        summary.records++;
+    }
+
+    record_reader_close(&reader);
+
+    if (ret < 0) {
+        fprintf(stderr, "%s: corrupted record %lu\n", path,
+                summary.records + 1);
+        return -1;
+    }
+
+    printf("%s: %lu records, %lu moves, position %+ld %+ld, path %lu px, "
+           "scroll %+ld %+ld, %lu presses, %lu releases\n", path,
+           summary.records, summary.moves, summary.x, summary.y,
+           summary.path, summary.scroll_x, summary.scroll_y,
+           summary.presses, summary.releases);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int opt, i, rc = EXIT_SUCCESS;
+
+    while ((opt = getopt(argc, argv, "v")) != -1) {
+        if (opt != 'v') {
+            fprintf(stderr, "Usage: %s [-v] FILE...\n", argv[0]);
+            exit(1);
+        }
+        verbose = 1;
+    }
+
+    for (i = optind; i < argc; i++)
+        if (replay(argv[i]))
+            rc = EXIT_FAILURE;
+
+    return rc;
+}
@@ -0,0 +1,50 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ring.h"
+
+/*
+ * Indices only grow (and wrap around at UINT_MAX): head - tail is the number
+ * of entries. Release stores publish the entry (or free its slot) before the
+ * index that tells the other side about it.
+ */
+#define LOAD(x)       __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE(x, v)   __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+int ring_push(struct ring *ring, const struct ring_entry *entry)
+{
+    unsigned int head = ring->head;
+
+    if (head - LOAD(ring->tail) == RING_SIZE)
+        return -1;
+
+    ring->entries[head % RING_SIZE] = *entry;
+    STORE(ring->head, head + 1);
+    return 0;
+}
+
+int ring_pop(struct ring *ring, struct ring_entry *entry)
+{
+    unsigned int tail = ring->tail;
+
+    if (LOAD(ring->head) == tail)
+        return 0;
+
+    *entry = ring->entries[tail % RING_SIZE];
+    STORE(ring->tail, tail + 1);
+    return 1;
+}
@@ -0,0 +1,53 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RING_H
+#define _RING_H
+
+#include <X11/Xlib.h>
+
+/*
+ * Single-producer single-consumer queue of key edges, from the thread that
+ * reads events to the one that moves the pointer. Pushing and popping are a
+ * few loads and stores, with no lock nor system call.
+ *
+ * There may be several consumer threads, as long as they never pop at the
+ * same time (e.g. under a common lock).
+ */
+#define RING_SIZE  64  /* power of two */
+
+#define RING_BATCH  0  /* end of a batch of edges, instead of KeyPress... */
+
+struct ring_entry {
+    int type;               /* KeyPress, KeyRelease or RING_BATCH */
+    KeyCode keycode;
+    unsigned long time;     /* ms for edges, batch start in us */
+};
+
+struct ring {
+    struct ring_entry entries[RING_SIZE];
+    unsigned int head;      /* written by the producer only */
+    unsigned int tail;      /* written by the consumer only */
+};
+
+/* Return -1 if the ring is full */
+int ring_push(struct ring *ring, const struct ring_entry *entry);
+
+/* Return 0 if the ring is empty */
+int ring_pop(struct ring *ring, struct ring_entry *entry);
+
+#endif
@@ -0,0 +1,1349 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "session.h"
+#include "evdev.h"
+#include "loop.h"
+#include "motion.h"
+#include "record.h"
+#include "stats.h"
+#include "xinput.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/XKBlib.h>
+
+#define DISPLAY ":0"
+
+// Leave mouse mode if no key is touched for 60 seconds
+#define IDLE_TIMEOUT  60000
+
+// Tick rate when the refresh rate of the monitor is not known (Hz)
+#define FALLBACK_TICK_RATE  50
+
+// Always selected on the root window: top-level windows, for snapping
+#define ROOT_EVENT_MASK  SubstructureNotifyMask
+
+static const char *output;
+
+// Master pointer to drive instead of the core one, NULL for the core one
+static const char *pointer;
+
+// Keys are read from evdev devices instead of X, for this session only
+static int evdev_input, evdev_opened;
+static struct session *evdev_session;
+
+// Shared by all keyboards
+static struct accel_curve curve, scroll_curve;
+
+/*
+ * Time of the current batch of events or tick. Keyboards read it instead of
+ * the real clock, so that the time written to the record is exactly the one
+ * used for computations. Sessions are processed one at a time, so they can
+ * share it.
+ */
+static unsigned long batch_time;
+
+static unsigned long batch_milliseconds()
+{
+    return batch_time;
+}
+
+/*
+ *  Mask        | Value | Key
+ * -------------+-------+------------
+ *  ShiftMask   |     1 | Shift
+ *  LockMask    |     2 | Caps Lock
+ *  ControlMask |     4 | Ctrl
+ *  Mod1Mask    |     8 | Alt
+ *  Mod2Mask    |    16 | Num Lock
+ *  Mod3Mask    |    32 | Scroll Lock
+ *  Mod4Mask    |    64 | Windows
+ *  Mod5Mask    |   128 | ???
+ */
+
+static void grab_key(Display *display, int keycode, unsigned int modifiers)
+{
+    XGrabKey(display, keycode, modifiers, DefaultRootWindow(display),
+             True, GrabModeAsync, GrabModeAsync);
+    if (modifiers != AnyModifier)
+        XGrabKey(display, keycode, modifiers | Mod2Mask /* numlock */,
+                 DefaultRootWindow(display), True,
+                 GrabModeAsync, GrabModeAsync);
+}
+static void ungrab_key(Display *display, int keycode, unsigned int modifiers)
+{
+    // XUngrabKey(display, keycode, AnyModifier, DefaultRootWindow(display));
+    XUngrabKey(display, keycode, modifiers, DefaultRootWindow(display));
+    if (modifiers != AnyModifier)
+        XUngrabKey(display, keycode, modifiers | Mod2Mask /* numlock */,
+                   DefaultRootWindow(display));
+}
+
+static void enable_trigger_combination(struct session *session)
+{
+    // evdev devices give all key events, no need to grab
+    if (session == evdev_session)
+        return;
+
+    grab_key(session->display,
+             binding_keycode(&session->keyboard, BINDING_MOUSE_MODE),
+             session->keymap.trigger_modifiers);
+}
+
+static void disable_trigger_combination(struct session *session)
+{
+    if (session == evdev_session)
+        return;
+
+    ungrab_key(session->display,
+               binding_keycode(&session->keyboard, BINDING_MOUSE_MODE),
+               session->keymap.trigger_modifiers);
+}
+
+static int mouse_mode_combination_trigerred(struct session *session,
+                                            int type, KeyCode keycode,
+                                            unsigned int modifiers)
+{
+    unsigned int trigger = session->keymap.trigger_modifiers;
+
+    // With X, the passive grab already checked modifiers
+    if (session == evdev_session && (modifiers & trigger) != trigger)
+        return 0;
+
+    return type == KeyRelease &&
+           keycode_binding(&session->keyboard, keycode) == BINDING_MOUSE_MODE;
+}
+
+static int normal_mode_combination_trigerred(struct session *session,
+                                             int type, KeyCode keycode)
+{
+    return type == KeyRelease &&
+           keycode_binding(&session->keyboard, keycode) ==
+           BINDING_NORMAL_MODE;
+    // modifiers == ControlMask | Mod4Mask /* super */;
+}
+
+/*
+ * X timestamps are milliseconds of the server clock, on 32 bits. Convert
+ * them to our clock with the smallest offset seen so far: this is the one
+ * with the least transport latency. Each server has its own clock.
+ */
+static unsigned long event_milliseconds(struct session *session, Time time)
+{
+    unsigned long now = current_milliseconds();
+    uint32_t latency;
+
+    latency = (uint32_t) now - (uint32_t) time - session->clock_offset;
+
+    // Server clock went backwards or jumped (restart, drift): resync
+    if (!session->clock_known || (int32_t) latency < 0 || latency > 1000) {
+        session->clock_offset = (uint32_t) now - (uint32_t) time;
+        latency = 0;
+        session->clock_known = 1;
+    }
+
+    return now - latency;
+}
+
+static void record(struct session *session, enum record_type type,
+                   unsigned long time, KeyCode keycode)
+{
+    if (session->recorded)
+        record_write(type, time, keycode);
+}
+
+static void process_pointer_movement(struct session *session)
+{
+    int dx = 0,
+        dy = 0;
+    double scroll_x, scroll_y;
+
+    compute_pointer_movement(&session->keyboard, &dx, &dy);
+
+    if (dx || dy) {
+        mouse_move(&session->mouse, dx, dy);
+        // printf("moving %d %d\n", dx, dy);
+    }
+
+    // At most one scroll per tick, whatever the number of wheel clicks
+    compute_scroll(&session->keyboard, &scroll_x, &scroll_y,
+                   !mouse_smooth_scroll(&session->mouse));
+    if (scroll_x || scroll_y)
+        mouse_scroll(&session->mouse, scroll_x, scroll_y);
+}
+
+static const struct {
+    unsigned int button;
+    const char *name;
+} buttons[BINDING_COUNT] = {
+    [BINDING_LCLICK] = { MOUSE_LEFT_BUTTON, "left" },
+    [BINDING_MCLICK] = { MOUSE_MIDDLE_BUTTON, "middle" },
+    [BINDING_RCLICK] = { MOUSE_RIGHT_BUTTON, "right" }
+};
+
+static void process_pointer_clicks(struct session *session)
+{
+    struct pointer_click clicks[16];
+    int n, i;
+
+    do {
+        n = compute_pointer_clicks(&session->keyboard, clicks, 16);
+
+        for (i = 0; i < n; i++) {
+            unsigned int button = buttons[clicks[i].binding].button;
+
+            if (clicks[i].dx || clicks[i].dy)
+                mouse_move(&session->mouse, clicks[i].dx, clicks[i].dy);
+
+            if (clicks[i].press) {
+                mouse_press_button(&session->mouse, button);
+                printf("%s click...\n", buttons[clicks[i].binding].name);
+            } else {
+                mouse_release_button(&session->mouse, button);
+                printf("         release!\n");
+            }
+        }
+    } while (n == 16);
+}
+
+/*
+ * Tick period (us): one per frame of the monitor under the pointer, unless a
+ * rate is configured. Ticking faster would compute moves nobody sees,
+ * slower would make the pointer skip frames.
+ */
+static unsigned long tick_period(struct session *session)
+{
+    const struct monitor *m;
+    int x, y;
+
+    if (session->tick_rate)
+        return 1000000 / session->tick_rate;
+
+    mouse_get_position(&session->mouse, &x, &y);
+    m = monitor_get(&session->monitors,
+                    monitor_at(&session->monitors, x, y));
+    if (!m->refresh_rate)
+        return 1000000 / FALLBACK_TICK_RATE;
+
+    return 1000000000UL / m->refresh_rate;
+}
+
+/*
+ * Ticks come from a timer of the event loop, or from the motion thread: its
+ * deadlines then follow `tick_deadline`.
+ */
+static int ticking(struct session *session)
+{
+    return motion_threaded() ? session->ticking
+                             : loop_timer_armed(session->tick_timer);
+}
+
+/* The pointer went to another monitor, or the config changed */
+static void update_tick_period(struct session *session)
+{
+    unsigned long period = tick_period(session);
+
+    if (period == session->tick_period)
+        return;
+
+    // The next deadline is kept, only the following ones change
+    session->tick_period = period;
+    if (!motion_threaded() && ticking(session))
+        loop_set_periodic_timer(session->tick_timer, session->tick_deadline,
+                                period);
+}
+
+/* `time` is in microseconds */
+static void start_ticking(struct session *session, unsigned long time)
+{
+    session->tick_deadline = time;
+    session->tick_period = tick_period(session);
+    if (motion_threaded()) {
+        session->ticking = 1;
+        motion_wake();
+    } else {
+        loop_set_periodic_timer(session->tick_timer, time,
+                                session->tick_period);
+    }
+}
+
+static void stop_ticking(struct session *session)
+{
+    session->ticking = 0;
+    if (!motion_threaded())
+        loop_disarm_timer(session->tick_timer);
+}
+
+/*
+ * Functions below, down to drain(), must be called with the motion lock
+ * held: they share the keyboard and the mouse with the motion thread.
+ */
+
+/* Do pointer actions for a batch of key events, started at `start` (us) */
+static void run_batch(struct session *session, unsigned long start)
+{
+    struct keyboard *keyboard = &session->keyboard;
+    unsigned long time;
+
+    // Process KeyPress and KeyRelease here (and not before), because when
+    // a key is maintained down X may send many release-then-press events
+    // (if detectable autorepeat is not supported)
+    time = batch_time = current_milliseconds();
+    record(session, RECORD_BATCH, time, 0);
+    process_pointer_clicks(session);
+
+    // Movement of short taps, that were released before any tick
+    if (!is_currently_moving_pointer(keyboard))
+        process_pointer_movement(session);
+
+    mouse_flush(&session->mouse);
+
+    stats_record(STATS_EVENT_PROCESSING, current_microseconds() - start);
+
+    // Start ticking as soon as a movement key is pressed. The first tick
+    // is immediate, next ones follow on absolute deadlines.
+    if (is_currently_moving_pointer(keyboard) && !ticking(session))
+        start_ticking(session, current_microseconds());
+}
+
+static void tick(struct session *session, unsigned long expirations)
+{
+    const struct mouse_stats *stats = mouse_get_stats(&session->mouse);
+    unsigned long requests = stats->requests;
+    unsigned long round_trips = stats->round_trips;
+    unsigned long time;
+
+    session->tick_deadline += (expirations - 1) * session->tick_period;
+    stats_record(STATS_TICK_JITTER,
+                 current_microseconds() - session->tick_deadline);
+
+    // Move to where the pointer should be at the deadline, not at wakeup:
+    // frames get even steps, whatever the jitter
+    time = batch_time = session->tick_deadline / 1000;
+    session->tick_deadline += session->tick_period;
+
+    record(session, RECORD_TICK, time, 0);
+
+    stats_count(STATS_TICKS, 1);
+    stats_count(STATS_MISSED_TICKS, expirations - 1);
+
+    process_pointer_clicks(session);
+    process_pointer_movement(session);
+    mouse_flush(&session->mouse);
+
+    stats_record(STATS_TICK_REQUESTS, stats->requests - requests);
+    stats_record(STATS_TICK_ROUND_TRIPS, stats->round_trips - round_trips);
+
+    // No wakeups when no movement key is held
+    if (!is_currently_moving_pointer(&session->keyboard))
+        stop_ticking(session);
+    else
+        update_tick_period(session);
+}
+
+/* Process key edges handed over by the event thread */
+static void drain(struct session *session)
+{
+    struct ring_entry edge;
+
+    while (ring_pop(&session->edges, &edge)) {
+        if (edge.type == RING_BATCH) {
+            run_batch(session, edge.time);
+            continue;
+        }
+
+        record(session, edge.type == KeyPress ? RECORD_KEY_PRESS :
+               RECORD_KEY_RELEASE, edge.time, edge.keycode);
+        process_keyboard_event(&session->keyboard, edge.type, edge.keycode,
+                               edge.time);
+    }
+}
+
+/* From the event thread */
+static void push_edge(struct session *session, int type, KeyCode keycode,
+                      unsigned long time)
+{
+    struct ring_entry edge = { .type = type, .keycode = keycode,
+                               .time = time };
+
+    // The motion thread is late: do its work here
+    if (ring_push(&session->edges, &edge)) {
+        motion_lock();
+        drain(session);
+        motion_unlock();
+        ring_push(&session->edges, &edge);
+    }
+}
+
+/* Keys of all bindings but the trigger, and digits of counts */
+static int grabbed_keycodes(struct session *session, KeyCode *keycodes)
+{
+    return keymap_keycodes(&session->keymap, keycodes);
+}
+
+static void grab_keyboard(struct session *session)
+{
+    Display *display = session->display;
+    KeyCode keycodes[256];
+    int ret;
+
+    if (session == evdev_session) {
+        evdev_grab(1);
+        return;
+    }
+
+    // Only grab the keys we use, so that the window manager can still grab
+    // the keyboard (see Design.md)
+    if (session->xi_opcode >= 0) {
+        xinput_grab_keys(display, keycodes,
+                         grabbed_keycodes(session, keycodes));
+        xinput_select_raw_events(display, 1);
+        return;
+    }
+
+    // TODO: Check return value (== AlreadyGrabbed)
+    ret = XGrabKeyboard(display, DefaultRootWindow(display),
+                        /*False, // */ True,
+                        /*GrabModeSync, GrabModeSync, // */
+                        GrabModeAsync, GrabModeAsync,
+                        CurrentTime);
+    if (ret)
+        fprintf(stderr, "%s: XGrabKeyboard returned %d\n",
+                DisplayString(display), ret);
+}
+
+static void ungrab_keyboard(struct session *session)
+{
+    KeyCode keycodes[256];
+
+    if (session == evdev_session) {
+        evdev_grab(0);
+        return;
+    }
+
+    if (session->xi_opcode >= 0) {
+        xinput_select_raw_events(session->display, 0);
+        xinput_ungrab_keys(session->display, keycodes,
+                           grabbed_keycodes(session, keycodes));
+        return;
+    }
+
+    XUngrabKeyboard(session->display, CurrentTime);
+}
+
+static void record_mapping(struct session *session)
+{
+    KeyCode keycodes[BINDING_COUNT];
+    int i;
+
+    if (!session->recorded)
+        return;
+
+    for (i = 0; i < BINDING_COUNT; i++)
+        keycodes[i] = binding_keycode(&session->keyboard, i);
+
+    record_write_mapping(current_milliseconds(), keycodes, BINDING_COUNT);
+}
+
+/* For the replay to build the same curves */
+static void record_accel(struct session *session)
+{
+    if (!session->recorded)
+        return;
+
+    record_write_accel(RECORD_ACCEL, current_milliseconds(), &curve.params);
+    record_write_accel(RECORD_SCROLL_ACCEL, current_milliseconds(),
+                       &scroll_curve.params);
+}
+
+static void enter_mouse_mode(struct session *session)
+{
+    Display *display = session->display;
+
+    printf("=== Entering MOUSE mode on %s (press escape to leave) ===\n",
+           DisplayString(display));
+
+    session->mouse_mode_on = 1;
+    memset(session->binding_down, 0, sizeof(session->binding_down));
+    memset(session->swallowed, 0, sizeof(session->swallowed));
+    memset(session->keys_down, 0, sizeof(session->keys_down));
+    keymap_reset(&session->keymap);
+
+    disable_trigger_combination(session);
+
+    grab_keyboard(session);
+
+    // TODO: Do we need this?
+    // XTestGrabControl (display, True);
+
+    motion_lock();
+    record(session, RECORD_ENTER, current_milliseconds(), 0);
+
+    // The position is queried again whenever something else moves the
+    // pointer: raw motion with XI2, root MotionNotify without (only when no
+    // window under the pointer takes them)
+    mouse_reset_stats(&session->mouse);
+    mouse_sync_position(&session->mouse);
+    motion_unlock();
+    if (session->xi_opcode < 0)
+        XSelectInput(display, DefaultRootWindow(display),
+                     ROOT_EVENT_MASK | PointerMotionMask);
+
+    session->last_activity_time = current_milliseconds();
+    loop_set_oneshot_timer(session->idle_timer,
+                           (session->last_activity_time + IDLE_TIMEOUT) * 1000);
+}
+
+static void leave_mouse_mode(struct session *session)
+{
+    Display *display = session->display;
+    const struct mouse_stats *stats;
+
+    session->mouse_mode_on = 0;
+
+    jump_stop(&session->jump);
+
+    loop_disarm_timer(session->idle_timer);
+
+    if (session->xi_opcode < 0)
+        XSelectInput(display, DefaultRootWindow(display), ROOT_EVENT_MASK);
+
+    ungrab_keyboard(session);
+
+    enable_trigger_combination(session);
+
+    motion_lock();
+    drain(session);
+    stop_ticking(session);
+
+    // Releases of keys still held go to other clients after the ungrab:
+    // forget them, or they would look held on the next entry
+    mouse_release_buttons(&session->mouse);
+    mouse_flush(&session->mouse);
+    reset_keyboard(&session->keyboard);
+
+    stats = mouse_get_stats(&session->mouse);
+    printf("Requests: %lu, round-trips: %lu, flushes: %lu\n",
+           stats->requests, stats->round_trips, stats->flushes);
+
+    record(session, RECORD_LEAVE, current_milliseconds(), 0);
+    if (session->recorded)
+        record_flush();
+    motion_unlock();
+
+    printf("=== Leaving MOUSE mode on %s ===\n", DisplayString(display));
+}
+
+static void jump_start_on_monitor(struct session *session, int i)
+{
+    const struct monitor *m = monitor_get(&session->monitors, i);
+
+    jump_start(&session->jump, m->x, m->y, m->width, m->height);
+}
+
+/*
+ * Return whether the key event was used by jump mode. Releases of movement
+ * keys still go to the keyboard state machine: they may have been pressed
+ * before jump mode started.
+ */
+static int process_jump_event(struct session *session, int type,
+                              enum binding binding, int repeat)
+{
+    struct jump *jump = &session->jump;
+    int x, y;
+
+    if (binding == BINDING_JUMP) {
+        if (repeat || type != KeyPress)
+            return 1;
+        if (jump_active(jump)) {
+            jump_stop(jump);
+        } else {
+            mouse_get_position(&session->mouse, &x, &y);
+            jump_start_on_monitor(session,
+                                  monitor_at(&session->monitors, x, y));
+        }
+        return 1;
+    }
+
+    if (!jump_active(jump))
+        return 0;
+
+    switch (binding) {
+    case BINDING_UP:
+    case BINDING_DOWN:
+    case BINDING_LEFT:
+    case BINDING_RIGHT:
+        if (type != KeyPress)
+            return 0;
+        if (!repeat)
+            jump_narrow(jump, binding);
+        return 1;
+    case BINDING_NORMAL_MODE:
+        // Only leave jump mode
+        if (type == KeyRelease)
+            jump_stop(jump);
+        return 1;
+    case BINDING_LCLICK:
+    case BINDING_MCLICK:
+    case BINDING_RCLICK:
+        // Click at the target
+        jump_stop(jump);
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Return whether the key event was a monitor switch. The pointer goes to the
+ * center of the previous or next monitor, in left to right order; in jump
+ * mode, the grid follows it.
+ */
+static int process_monitor_event(struct session *session, int type,
+                                 enum binding binding, int repeat)
+{
+    const struct monitors *monitors = &session->monitors;
+    const struct monitor *m;
+    int i, x, y;
+
+    if (binding != BINDING_PREV_MONITOR && binding != BINDING_NEXT_MONITOR)
+        return 0;
+    if (repeat || type != KeyPress)
+        return 1;
+
+    mouse_get_position(&session->mouse, &x, &y);
+    i = monitor_at(monitors, x, y) +
+        (binding == BINDING_NEXT_MONITOR ? 1 : -1);
+    i = (i + monitor_count(monitors)) % monitor_count(monitors);
+
+    if (jump_active(&session->jump)) {
+        jump_start_on_monitor(session, i);
+    } else {
+        m = monitor_get(monitors, i);
+        mouse_move_to(&session->mouse, m->x + m->width / 2,
+                      m->y + m->height / 2);
+    }
+    return 1;
+}
+
+/*
+ * Return whether the key event was a snap: the pointer goes to the nearest
+ * edge or center of a window in that direction. Jump mode is left.
+ */
+static int process_snap_event(struct session *session, int type,
+                              enum binding binding, int repeat)
+{
+    static const int directions[BINDING_COUNT][2] = {
+        [BINDING_SNAP_UP]    = { 0, -1 },
+        [BINDING_SNAP_DOWN]  = { 0, 1 },
+        [BINDING_SNAP_LEFT]  = { -1, 0 },
+        [BINDING_SNAP_RIGHT] = { 1, 0 }
+    };
+    const int *direction = directions[binding];
+    int x, y;
+
+    if (!direction[0] && !direction[1])
+        return 0;
+    if (repeat || type != KeyPress)
+        return 1;
+
+    jump_stop(&session->jump);
+
+    mouse_get_position(&session->mouse, &x, &y);
+    if (!snap_target(&session->snap, direction[0], direction[1], &x, &y))
+        mouse_move_to(&session->mouse, x, y);
+    return 1;
+}
+
+/* Whether the binding may go to jump mode, monitor switches or snapping */
+static int moves_pointer(struct session *session, enum binding binding)
+{
+    switch (binding) {
+    case BINDING_JUMP:
+    case BINDING_PREV_MONITOR:
+    case BINDING_NEXT_MONITOR:
+    case BINDING_SNAP_UP:
+    case BINDING_SNAP_DOWN:
+    case BINDING_SNAP_LEFT:
+    case BINDING_SNAP_RIGHT:
+        return 1;
+    default:
+        // Only read and written by the event thread
+        return jump_active(&session->jump);
+    }
+}
+
+/*
+ * Bindings typed as a sequence, a chord or after a count are taps, done on
+ * the last key press: movement keys move by one step, click keys click.
+ */
+static void tap(struct session *session, enum binding binding)
+{
+    int step = curve.params.step + 0.5;
+    int scroll = scroll_curve.params.step + 0.5;
+
+    switch (binding) {
+    case BINDING_UP:
+        mouse_move(&session->mouse, 0, -step);
+        break;
+    case BINDING_DOWN:
+        mouse_move(&session->mouse, 0, step);
+        break;
+    case BINDING_LEFT:
+        mouse_move(&session->mouse, -step, 0);
+        break;
+    case BINDING_RIGHT:
+        mouse_move(&session->mouse, step, 0);
+        break;
+    case BINDING_LCLICK:
+    case BINDING_MCLICK:
+    case BINDING_RCLICK:
+        mouse_press_button(&session->mouse, buttons[binding].button);
+        mouse_release_button(&session->mouse, buttons[binding].button);
+        break;
+    case BINDING_SCROLL_UP:
+        mouse_scroll(&session->mouse, 0, -scroll);
+        break;
+    case BINDING_SCROLL_DOWN:
+        mouse_scroll(&session->mouse, 0, scroll);
+        break;
+    case BINDING_SCROLL_LEFT:
+        mouse_scroll(&session->mouse, -scroll, 0);
+        break;
+    case BINDING_SCROLL_RIGHT:
+        mouse_scroll(&session->mouse, scroll, 0);
+        break;
+    default:
+        break;
+    }
+}
+
+static void run_taps(struct session *session, enum binding binding,
+                     unsigned int count)
+{
+    if (binding == BINDING_NORMAL_MODE && !jump_active(&session->jump)) {
+        leave_mouse_mode(session);
+        return;
+    }
+
+    motion_lock();
+
+    // Key edges already read come first
+    drain(session);
+
+    if (binding == BINDING_NORMAL_MODE) {
+        jump_stop(&session->jump);
+    } else {
+        while (count--)
+            if (!process_jump_event(session, KeyPress, binding, 0) &&
+                !process_monitor_event(session, KeyPress, binding, 0) &&
+                !process_snap_event(session, KeyPress, binding, 0))
+                tap(session, binding);
+    }
+
+    mouse_flush(&session->mouse);
+    motion_unlock();
+}
+
+/* `time` is in milliseconds of our clock, `modifiers` are X masks */
+static void process_key_event(struct session *session, int type,
+                              KeyCode keycode, unsigned int modifiers,
+                              unsigned long time)
+{
+    enum binding binding, action;
+    unsigned int count;
+    int repeat, used;
+
+    if (!session->mouse_mode_on) {
+        if (mouse_mode_combination_trigerred(session, type, keycode,
+                                             modifiers))
+            enter_mouse_mode(session);
+        return;
+    }
+
+    session->last_activity_time = time;
+    stats_record(STATS_EVENT_DELIVERY, current_milliseconds() - time);
+
+    if (session->swallowed[keycode]) {
+        if (type == KeyRelease)
+            session->swallowed[keycode] = 0;
+        return;
+    }
+
+    binding = keycode_binding(&session->keyboard, keycode);
+    repeat = type == KeyPress && session->binding_down[binding];
+
+    // Plain bindings go on below, unless typed after a count
+    if (type == KeyPress && !repeat) {
+        switch (keymap_press(&session->keymap, keycode, modifiers,
+                             &action, &count)) {
+        case KEYMAP_PENDING:
+            session->swallowed[keycode] = 1;
+            return;
+        case KEYMAP_MATCH:
+            if (action == binding && count == 1)
+                break;
+            session->swallowed[keycode] = 1;
+            run_taps(session, action, count);
+            return;
+        default:
+            break;
+        }
+    }
+
+    session->binding_down[binding] = type == KeyPress;
+
+    // They move the pointer: the lock is only taken for them, not to delay
+    // ticks on every key event
+    if (moves_pointer(session, binding)) {
+        motion_lock();
+        used = process_jump_event(session, type, binding, repeat) ||
+               process_monitor_event(session, type, binding, repeat) ||
+               process_snap_event(session, type, binding, repeat);
+        motion_unlock();
+        if (used)
+            return;
+    }
+
+    if (normal_mode_combination_trigerred(session, type, keycode)) {
+        leave_mouse_mode(session);
+        return;
+    }
+
+    push_edge(session, type, keycode, time);
+}
+
+/* With the motion lock held */
+static void compile_mapping(struct session *session)
+{
+    KeyCode keycodes[BINDING_COUNT];
+
+    keymap_compile(&session->keymap, session->display, keycodes);
+    set_keycodes(&session->keyboard, keycodes);
+    record_mapping(session);
+}
+
+/* Recompile bindings, after a keymap or config change */
+static void update_mapping(struct session *session)
+{
+    // Release grabs with the old keycodes before recompiling bindings
+    if (session->mouse_mode_on)
+        ungrab_keyboard(session);
+    else
+        disable_trigger_combination(session);
+
+    // Edges already read go with the old keycodes
+    motion_lock();
+    drain(session);
+    compile_mapping(session);
+    motion_unlock();
+
+    if (session->mouse_mode_on)
+        grab_keyboard(session);
+    else
+        enable_trigger_combination(session);
+}
+
+static void process_mapping_event(struct session *session,
+                                  XMappingEvent *event)
+{
+    if (event->request == MappingPointer)
+        return;
+
+    XRefreshKeyboardMapping(event);
+    update_mapping(session);
+}
+
+static void process_x_event(struct session *session, XEvent *event)
+{
+    struct xinput_event xievent;
+    struct monitors monitors;
+
+    if (xinput_event(session->display, session->xi_opcode, event,
+                     &xievent)) {
+        // Nobody else moves a master pointer of our own
+        if (xievent.type == MotionNotify) {
+            if (!session->output_display)
+                session->pointer_moved = 1;
+            return;
+        }
+
+        // Only the first release of a key we saw pressed
+        if (xievent.type == KeyRelease &&
+            !session->keys_down[xievent.keycode])
+            return;
+        session->keys_down[xievent.keycode] = xievent.type == KeyPress;
+
+        process_key_event(session, xievent.type, xievent.keycode,
+                          xievent.modifiers,
+                          event_milliseconds(session, xievent.time));
+        return;
+    }
+
+    if (event->type == MappingNotify) {
+        process_mapping_event(session, &event->xmapping);
+        return;
+    }
+
+    // Only read by the event thread: no lock
+    if (snap_process_event(&session->snap, event))
+        return;
+
+    if (event->type == MotionNotify) {
+        session->pointer_moved = 1;
+        return;
+    }
+
+    // Monitors are used to clamp moves: queried without the lock, swapped
+    // in with it
+    if (monitor_process_event(&session->monitors, event, &monitors)) {
+        motion_lock();
+        session->monitors = monitors;
+        motion_unlock();
+        return;
+    }
+
+    if (event->type == KeyPress || event->type == KeyRelease)
+        process_key_event(session, event->type, event->xkey.keycode,
+                          event->xkey.state,
+                          event_milliseconds(session, event->xkey.time));
+}
+
+/*
+ * End of a batch of key events (X or evdev), started at `start` (us): hand
+ * it over for pointer actions.
+ */
+static void process_batch(struct session *session, unsigned long start)
+{
+    if (!session->mouse_mode_on)
+        return;
+
+    // One query for all motion of the batch, collected when next needed
+    if (session->pointer_moved) {
+        session->pointer_moved = 0;
+        motion_lock();
+        mouse_sync_position(&session->mouse);
+        motion_unlock();
+    }
+
+    push_edge(session, RING_BATCH, 0, start);
+
+    if (motion_threaded()) {
+        motion_wake();
+    } else {
+        motion_lock();
+        drain(session);
+        motion_unlock();
+    }
+}
+
+static void process_x_events(struct session *session)
+{
+    unsigned long start = current_microseconds();
+
+    // Get all X events before doing any pointer action. XPending() returns
+    // 0 once the connection is lost.
+    while (XPending(session->display)) {
+        XEvent event;
+
+        XNextEvent(session->display, &event);
+        process_x_event(session, &event);
+    }
+
+    if (!session->lost)
+        process_batch(session, start);
+}
+
+static void on_x_readable(int fd, void *data)
+{
+    process_x_events(data);
+}
+
+void session_prepare(struct session *session)
+{
+    if (session->lost)
+        return;
+
+    // Xlib may already hold events in its queue (read while waiting for a
+    // reply for instance): the socket would not wake us up for them.
+    if (XEventsQueued(session->display, QueuedAlready))
+        process_x_events(session);
+
+    XFlush(session->display);
+}
+
+static void on_tick(unsigned long expirations, void *data)
+{
+    struct session *session = data;
+
+    if (session->lost)
+        return;
+
+    motion_lock();
+    tick(session, expirations);
+    motion_unlock();
+}
+
+/* In the motion thread, see motion_callback */
+static unsigned long on_motion(void *data)
+{
+    struct session *session = data;
+    unsigned long now;
+
+    if (session->lost)
+        return 0;
+
+    drain(session);
+    if (!session->ticking)
+        return 0;
+
+    now = current_microseconds();
+    if (now >= session->tick_deadline)
+        tick(session, 1 + (now - session->tick_deadline) /
+                      session->tick_period);
+
+    return session->ticking ? session->tick_deadline : 0;
+}
+
+static void on_idle_timeout(unsigned long expirations, void *data)
+{
+    struct session *session = data;
+    unsigned long deadline = session->last_activity_time + IDLE_TIMEOUT;
+
+    if (!session->mouse_mode_on || session->lost)
+        return;
+
+    // The timer is not rearmed on every key event, only here if there was
+    // some activity since it was set.
+    if (current_milliseconds() < deadline) {
+        loop_set_oneshot_timer(session->idle_timer, deadline * 1000);
+        return;
+    }
+
+    printf("No activity for %d seconds\n", IDLE_TIMEOUT / 1000);
+    leave_mouse_mode(session);
+}
+
+static void on_evdev_key(int type, unsigned char keycode, unsigned long time)
+{
+    struct session *session = evdev_session;
+
+    // Display lost, until it comes back
+    if (!session)
+        return;
+
+    if (!session->evdev_batch_start)
+        session->evdev_batch_start = current_microseconds();
+
+    process_key_event(session, type, keycode, evdev_modifiers(), time);
+}
+
+static void on_evdev_batch()
+{
+    struct session *session = evdev_session;
+
+    if (!session || !session->evdev_batch_start)
+        return;
+
+    process_batch(session, session->evdev_batch_start);
+    session->evdev_batch_start = 0;
+}
+
+void session_control(struct session *session,
+                     const struct control_command *command)
+{
+    struct mouse *mouse = &session->mouse;
+
+    if (command->type == CONTROL_DISPLAY)
+        return;
+
+    motion_lock();
+
+    // The pointer position is only followed in mouse mode: otherwise, ask
+    // for it once per batch (moves are clamped to monitors)
+    if (!session->control_pending && !session->mouse_mode_on)
+        mouse_sync_position(mouse);
+    session->control_pending = 1;
+
+    switch (command->type) {
+    case CONTROL_MOVE:
+        mouse_move(mouse, command->x, command->y);
+        break;
+    case CONTROL_MOVE_TO:
+        mouse_move_to(mouse, command->x, command->y);
+        break;
+    case CONTROL_PRESS:
+        mouse_press_button(mouse, command->button);
+        break;
+    case CONTROL_RELEASE:
+        mouse_release_button(mouse, command->button);
+        break;
+    case CONTROL_CLICK:
+        mouse_press_button(mouse, command->button);
+        mouse_release_button(mouse, command->button);
+        break;
+    case CONTROL_SCROLL:
+        mouse_scroll(mouse, command->x, command->y);
+        break;
+    default:
+        break;
+    }
+
+    motion_unlock();
+}
+
+void session_control_flush(struct session *session)
+{
+    if (!session->control_pending)
+        return;
+
+    motion_lock();
+    mouse_flush(&session->mouse);
+    motion_unlock();
+    session->control_pending = 0;
+}
+
+#ifdef HAVE_XSETIOERROREXITHANDLER
+/*
+ * Instead of exiting: Xlib calls on this display now fail, the session is
+ * closed before the next wait of the event loop.
+ */
+static void on_io_error_exit(Display *display, void *data)
+{
+    struct session *session = data;
+
+    fprintf(stderr, "%s: connection lost\n", DisplayString(display));
+    session->lost = 1;
+}
+#endif
+
+void session_set_backends(const char *output_backend, int evdev,
+                          const char *master_pointer)
+{
+    output = output_backend;
+    evdev_input = evdev;
+    pointer = master_pointer;
+}
+
+/*
+ * Pointer actions go through a second connection, whose client pointer is
+ * the master pointer: requests of the first one (key grabs) keep going to
+ * the core pointer and keyboard.
+ */
+static int open_pointer(struct session *session)
+{
+    Display *display = session->display;
+
+    if (session->xi_opcode < 0) {
+        fprintf(stderr, "%s: master pointers need XInput 2\n",
+                DisplayString(display));
+        return -1;
+    }
+
+    session->pointer_id = xinput_master_pointer(display, pointer,
+                                                &session->pointer_created);
+    if (session->pointer_id < 0)
+        return -1;
+
+    session->output_display = XOpenDisplay(DisplayString(display));
+    if (!session->output_display) {
+        fprintf(stderr, "Cannot XOpenDisplay %s\n", DisplayString(display));
+        return -1;
+    }
+#ifdef HAVE_XSETIOERROREXITHANDLER
+    XSetIOErrorExitHandler(session->output_display, on_io_error_exit,
+                           session);
+#endif
+
+    return xinput_set_client_pointer(session->output_display,
+                                     session->pointer_id);
+}
+
+static void close_pointer(struct session *session)
+{
+    if (session->output_display)
+        XCloseDisplay(session->output_display);
+
+    // One found in place may be someone else's
+    if (session->pointer_created && !session->lost)
+        xinput_remove_master(session->display, session->pointer_id);
+}
+
+struct session *session_open(const char *name, const struct config *config)
+{
+    struct session *session;
+    Display *display;
+    Bool supported;
+
+    // Use $DISPLAY if set
+    if (!name)
+        name = getenv("DISPLAY") ? NULL : DISPLAY;
+
+    display = XOpenDisplay(name);
+    if (display == NULL) {
+        fprintf(stderr, "Cannot XOpenDisplay %s\n", name ? name : "");
+        return NULL;
+    }
+
+    session = calloc(1, sizeof(*session));
+    if (!session) {
+        perror("calloc");
+        XCloseDisplay(display);
+        return NULL;
+    }
+    if (name)
+        snprintf(session->name, sizeof(session->name), "%s", name);
+    session->display = display;
+
+#ifdef HAVE_XSETIOERROREXITHANDLER
+    XSetIOErrorExitHandler(display, on_io_error_exit, session);
+#endif
+
+    // Before any pointer movement, that is clamped to monitors
+    monitor_init(&session->monitors, display);
+
+    // Selected before the tree is walked: no change is missed
+    XSelectInput(display, DefaultRootWindow(display), ROOT_EVENT_MASK);
+    snap_init(&session->snap, display);
+
+    session->xi_opcode = xinput_init(display);
+
+    if ((pointer && open_pointer(session)) ||
+        mouse_init(&session->mouse, session->output_display ?
+                   session->output_display : display, output,
+                   &session->monitors)) {
+        close_pointer(session);
+        XCloseDisplay(display);
+        snap_free(&session->snap);
+        free(session);
+        return NULL;
+    }
+
+    jump_init(&session->jump, display, &session->mouse);
+
+    keyboard_init(&session->keyboard, batch_milliseconds);
+    keymap_init(&session->keymap);
+
+    // Get KeyPress repeats instead of KeyRelease + KeyPress pairs
+    if (XkbSetDetectableAutoRepeat(display, True, &supported))
+        session->detectable_autorepeat = 1;
+
+    // The kernel flags autorepeats of evdev devices
+    if (evdev_input && !evdev_session) {
+        if (!evdev_opened && evdev_init(on_evdev_key, on_evdev_batch)) {
+            close_pointer(session);
+            XCloseDisplay(display);
+            snap_free(&session->snap);
+            free(session);
+            return NULL;
+        }
+        evdev_opened = 1;
+        evdev_session = session;
+        session->detectable_autorepeat = 1;
+    }
+    set_detectable_autorepeat(&session->keyboard,
+                              session->detectable_autorepeat);
+
+    loop_add_fd(ConnectionNumber(display), on_x_readable, session);
+    session->tick_timer = loop_add_timer(on_tick, session);
+    session->idle_timer = loop_add_timer(on_idle_timeout, session);
+
+    // Also compiles bindings and grabs the trigger
+    session_configure(session, config);
+
+    motion_lock();
+    motion_add(on_motion, session);
+    motion_unlock();
+
+    printf("Serving display %s\n", DisplayString(display));
+    return session;
+}
+
+void session_close(struct session *session)
+{
+    Display *display = session->display;
+
+    printf("Closing display %s\n", DisplayString(display));
+
+    motion_lock();
+    motion_remove(session);
+    motion_unlock();
+
+    if (!session->lost) {
+        if (session->mouse_mode_on)
+            leave_mouse_mode(session);
+        disable_trigger_combination(session);
+    }
+    if (session == evdev_session) {
+        evdev_grab(0);
+        evdev_session = NULL;
+    }
+
+    loop_remove_fd(ConnectionNumber(display));
+    loop_remove_timer(session->tick_timer);
+    loop_remove_timer(session->idle_timer);
+
+    close_pointer(session);
+
+    // Once the connection is lost, this only frees memory
+    XCloseDisplay(display);
+    keymap_free(&session->keymap);
+    snap_free(&session->snap);
+    free(session);
+}
+
+void session_configure(struct session *session, const struct config *config)
+{
+    // Curves are shared by all sessions: the lock is global
+    motion_lock();
+
+    keymap_set_sequences(&session->keymap, config->keys);
+
+    // Checked by config_load(): this cannot fail
+    accel_build(&curve, &config->accel);
+    accel_build(&scroll_curve, &config->scroll_accel);
+    set_acceleration(&session->keyboard, &curve);
+    set_scroll_acceleration(&session->keyboard, &scroll_curve);
+    record_accel(session);
+
+    session->tick_rate = config->tick_rate;
+    if (ticking(session))
+        update_tick_period(session);
+
+    motion_unlock();
+
+    // Unmapped sessions have no grabs to release
+    if (binding_keycode(&session->keyboard, BINDING_MOUSE_MODE)) {
+        update_mapping(session);
+    } else {
+        motion_lock();
+        compile_mapping(session);
+        motion_unlock();
+        enable_trigger_combination(session);
+    }
+}
+
+void session_record(struct session *session)
+{
+    motion_lock();
+    session->recorded = 1;
+    record_mapping(session);
+    record_accel(session);
+    motion_unlock();
+}
@@ -0,0 +1,145 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SESSION_H
+#define _SESSION_H
+
+#include <stdint.h>
+#include <X11/Xlib.h>
+
+#include "config.h"
+#include "control.h"
+#include "jump.h"
+#include "keyboard.h"
+#include "keymap.h"
+#include "monitor.h"
+#include "mouse.h"
+#include "ring.h"
+#include "snap.h"
+
+/*
+ * Everything about one X display: connection, bindings and key states, grabs
+ * and mode, pointer. One event loop serves all sessions, that share nothing
+ * but the config: a display going away does not affect the others.
+ *
+ * A session is a few KB: acceleration curves are shared.
+ */
+struct session {
+    struct session *next;
+
+    char name[64];  /* as asked for, empty for $DISPLAY */
+    Display *display;
+
+    // The connection was lost: session_close() is all that is left to do
+    int lost;
+
+    int detectable_autorepeat;
+
+    // Members below are private
+
+    int xi_opcode;  /* -1 without XInput 2 */
+
+    // With a master pointer of our own: the connection driving it
+    Display *output_display;
+    int pointer_id;
+    int pointer_created;
+
+    struct keyboard keyboard;
+    struct keymap keymap;
+    struct mouse mouse;
+    struct monitors monitors;
+    struct jump jump;
+    struct snap snap;
+
+    int mouse_mode_on;
+
+    // Bindings currently down in mouse mode, to tell autorepeats apart
+    unsigned char binding_down[BINDING_COUNT];
+
+    // Keys taken by the keymap (sequences, counts, taps): their repeats and
+    // release are dropped
+    unsigned char swallowed[256];
+
+    // Keys pressed in mouse mode, with XI2: their release comes from the
+    // grab and as a raw event, or as a raw event only
+    unsigned char keys_down[256];
+
+    // Something else moved the pointer during this batch of X events: its
+    // position is to be queried again
+    int pointer_moved;
+
+    // Key edges, read here and processed with the motion lock held: by the
+    // motion thread if there is one
+    struct ring edges;
+
+    int tick_timer;
+    int idle_timer;
+    unsigned int tick_rate;     /* Hz, 0 to follow the monitor */
+    unsigned long tick_period;  /* us */
+
+    // With the motion thread, instead of the tick timer
+    int ticking;
+
+    // Next deadline of the tick timer (us)
+    unsigned long tick_deadline;
+
+    unsigned long last_activity_time;
+
+    // From the server clock to ours, see event_milliseconds()
+    int clock_known;
+    uint32_t clock_offset;
+
+    // Key events and ticks go to the record
+    int recorded;
+
+    unsigned long evdev_batch_start;
+
+    // Control commands were applied since the last flush
+    int control_pending;
+};
+
+/*
+ * Backends for all sessions, to set before opening any. Output to uinput
+ * and input from evdev are not tied to a display: only use them with one
+ * session. With `pointer`, each session drives the XI2 master pointer of
+ * this name (created if needed) instead of the core pointer.
+ */
+void session_set_backends(const char *output, int evdev_input,
+                          const char *pointer);
+
+/* Open display `name` (NULL for $DISPLAY), return NULL on error */
+struct session *session_open(const char *name, const struct config *config);
+
+void session_close(struct session *session);
+
+/* Apply a config (already checked): key states are kept */
+void session_configure(struct session *session, const struct config *config);
+
+/* Write key events of this session to the opened record */
+void session_record(struct session *session);
+
+/* Apply a command of the control socket, see control.h */
+void session_control(struct session *session,
+                     const struct control_command *command);
+
+/* Flush what control commands left, at the end of a batch */
+void session_control_flush(struct session *session);
+
+/* Before the event loop waits */
+void session_prepare(struct session *session);
+
+#endif
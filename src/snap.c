@@ -0,0 +1,289 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "snap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Make room for `needed` items */
+static void *grow(void *array, int *size, size_t item_size, int needed)
+{
+    if (needed <= *size)
+        return array;
+
+    *size = needed < 16 ? 16 : needed < 2 * *size ? 2 * *size : needed;
+    array = realloc(array, *size * item_size);
+    if (!array) {
+        perror("realloc");
+        exit(1);
+    }
+    return array;
+}
+
+/* Index of the first line at `position` or after */
+static int lower_bound(const struct snap_line *lines, int n, int position)
+{
+    int low = 0, high = n, middle;
+
+    while (low < high) {
+        middle = (low + high) / 2;
+        if (lines[middle].position < position)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+static void insert_line(struct snap *snap, enum snap_axis axis,
+                        int position, int from, int to, Window window)
+{
+    struct snap_line *lines;
+    int i, n = snap->n_lines[axis];
+
+    lines = snap->lines[axis] = grow(snap->lines[axis],
+                                     &snap->lines_size[axis],
+                                     sizeof(*lines), n + 1);
+
+    i = lower_bound(lines, n, position);
+    memmove(&lines[i + 1], &lines[i], (n - i) * sizeof(*lines));
+    lines[i].position = position;
+    lines[i].from = from;
+    lines[i].to = to;
+    lines[i].window = window;
+
+    snap->n_lines[axis]++;
+}
+
+static void remove_lines(struct snap *snap, Window window)
+{
+    struct snap_line *lines;
+    int axis, i, n;
+
+    for (axis = 0; axis < 2; axis++) {
+        lines = snap->lines[axis];
+        for (i = n = 0; i < snap->n_lines[axis]; i++)
+            if (lines[i].window != window)
+                lines[n++] = lines[i];
+        snap->n_lines[axis] = n;
+    }
+}
+
+/* Edges, then centers: the pointer lands inside the window */
+static void update_lines(struct snap *snap, const struct snap_window *window)
+{
+    int right = window->x + window->width - 1;
+    int bottom = window->y + window->height - 1;
+
+    remove_lines(snap, window->id);
+    if (!window->mapped || window->width <= 0 || window->height <= 0)
+        return;
+
+    insert_line(snap, SNAP_VERTICAL, window->x, window->y, bottom,
+                window->id);
+    insert_line(snap, SNAP_VERTICAL, window->x + window->width / 2,
+                window->y, bottom, window->id);
+    insert_line(snap, SNAP_VERTICAL, right, window->y, bottom, window->id);
+
+    insert_line(snap, SNAP_HORIZONTAL, window->y, window->x, right,
+                window->id);
+    insert_line(snap, SNAP_HORIZONTAL, window->y + window->height / 2,
+                window->x, right, window->id);
+    insert_line(snap, SNAP_HORIZONTAL, bottom, window->x, right, window->id);
+}
+
+static struct snap_window *find_window(struct snap *snap, Window id)
+{
+    int i;
+
+    for (i = 0; i < snap->n_windows; i++)
+        if (snap->windows[i].id == id)
+            return &snap->windows[i];
+
+    return NULL;
+}
+
+static void set_geometry(struct snap_window *window, int x, int y,
+                         int width, int height, int border_width)
+{
+    window->x = x;
+    window->y = y;
+    window->width = width + 2 * border_width;
+    window->height = height + 2 * border_width;
+}
+
+static struct snap_window *add_window(struct snap *snap, Window id)
+{
+    struct snap_window *window = find_window(snap, id);
+
+    if (window)
+        return window;
+
+    snap->windows = grow(snap->windows, &snap->windows_size,
+                         sizeof(*snap->windows), snap->n_windows + 1);
+    window = &snap->windows[snap->n_windows++];
+    memset(window, 0, sizeof(*window));
+    window->id = id;
+    return window;
+}
+
+static void remove_window(struct snap *snap, Window id)
+{
+    struct snap_window *window = find_window(snap, id);
+
+    if (!window)
+        return;
+
+    remove_lines(snap, id);
+    *window = snap->windows[--snap->n_windows];
+}
+
+/* A round-trip: only on startup, and when a window comes back to the root */
+static void query_window(struct snap *snap, Window id)
+{
+    XWindowAttributes attributes;
+    struct snap_window *window;
+
+    // Gone already, or a menu or tooltip
+    if (!XGetWindowAttributes(snap->display, id, &attributes) ||
+        attributes.override_redirect)
+        return;
+
+    window = add_window(snap, id);
+    set_geometry(window, attributes.x, attributes.y, attributes.width,
+                 attributes.height, attributes.border_width);
+    window->mapped = attributes.map_state != IsUnmapped;
+    update_lines(snap, window);
+}
+
+void snap_init(struct snap *snap, Display *display)
+{
+    Window root, parent, *children;
+    unsigned int i, n;
+
+    memset(snap, 0, sizeof(*snap));
+    snap->display = display;
+
+    if (!XQueryTree(display, DefaultRootWindow(display), &root, &parent,
+                    &children, &n))
+        return;
+
+    for (i = 0; i < n; i++)
+        query_window(snap, children[i]);
+    XFree(children);
+}
+
+void snap_free(struct snap *snap)
+{
+    free(snap->windows);
+    free(snap->lines[SNAP_VERTICAL]);
+    free(snap->lines[SNAP_HORIZONTAL]);
+    memset(snap, 0, sizeof(*snap));
+}
+
+static void set_mapped(struct snap *snap, Window id, int mapped)
+{
+    struct snap_window *window = find_window(snap, id);
+
+    if (!window)
+        return;
+
+    window->mapped = mapped;
+    update_lines(snap, window);
+}
+
+int snap_process_event(struct snap *snap, XEvent *event)
+{
+    Window root = DefaultRootWindow(snap->display);
+    struct snap_window *window;
+
+    // Events of SubstructureNotifyMask are reported on the parent: ours
+    // are those of children of the root
+    if (event->xany.window != root)
+        return 0;
+
+    switch (event->type) {
+    case CreateNotify:
+        if (!event->xcreatewindow.override_redirect) {
+            window = add_window(snap, event->xcreatewindow.window);
+            set_geometry(window, event->xcreatewindow.x,
+                         event->xcreatewindow.y, event->xcreatewindow.width,
+                         event->xcreatewindow.height,
+                         event->xcreatewindow.border_width);
+        }
+        return 1;
+    case DestroyNotify:
+        remove_window(snap, event->xdestroywindow.window);
+        return 1;
+    case MapNotify:
+        set_mapped(snap, event->xmap.window, 1);
+        return 1;
+    case UnmapNotify:
+        set_mapped(snap, event->xunmap.window, 0);
+        return 1;
+    case ConfigureNotify:
+        window = find_window(snap, event->xconfigure.window);
+        if (window) {
+            set_geometry(window, event->xconfigure.x, event->xconfigure.y,
+                         event->xconfigure.width, event->xconfigure.height,
+                         event->xconfigure.border_width);
+            update_lines(snap, window);
+        }
+        return 1;
+    case ReparentNotify:
+        // Into a frame of the window manager, or back to the root
+        if (event->xreparent.parent == root)
+            query_window(snap, event->xreparent.window);
+        else
+            remove_window(snap, event->xreparent.window);
+        return 1;
+    case GravityNotify:
+    case CirculateNotify:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int snap_target(const struct snap *snap, int dx, int dy, int *x, int *y)
+{
+    enum snap_axis axis = dx ? SNAP_VERTICAL : SNAP_HORIZONTAL;
+    const struct snap_line *lines = snap->lines[axis];
+    int n = snap->n_lines[axis];
+    int *position = dx ? x : y;
+    int across = dx ? *y : *x;
+    int direction = dx ? dx : dy;
+    int i;
+
+    // Nearest line beyond the pointer, then further ones
+    if (direction > 0)
+        i = lower_bound(lines, n, *position + 1);
+    else
+        i = lower_bound(lines, n, *position) - 1;
+
+    for (; i >= 0 && i < n; i += direction) {
+        if (lines[i].from <= across && across <= lines[i].to) {
+            *position = lines[i].position;
+            return 0;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,82 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SNAP_H
+#define _SNAP_H
+
+#include <X11/Xlib.h>
+
+/*
+ * Geometry of top-level windows (frames, with a reparenting window manager),
+ * to snap the pointer to their edges and centers. The window tree is walked
+ * once, then the index follows SubstructureNotify events of the root window:
+ * snapping never talks to the server.
+ *
+ * Lines (left, center and right of each mapped window, then top, center and
+ * bottom) are kept sorted by position on their axis: a snap is a binary
+ * search, then a walk to the first line that crosses the pointer. Stacking
+ * is ignored: edges of hidden windows are targets too.
+ */
+
+struct snap_window {
+    Window id;
+    int x, y;
+    int width, height;  /* with borders */
+    int mapped;
+};
+
+struct snap_line {
+    int position;
+    int from, to;  /* extent on the other axis */
+    Window window;
+};
+
+enum snap_axis {
+    SNAP_VERTICAL,   /* lines at some x */
+    SNAP_HORIZONTAL  /* lines at some y */
+};
+
+/* Index of a display. Members are private: use the functions below. */
+struct snap {
+    Display *display;
+
+    struct snap_window *windows;
+    int n_windows, windows_size;
+
+    struct snap_line *lines[2];
+    int n_lines[2], lines_size[2];
+};
+
+/*
+ * Walk the window tree. SubstructureNotifyMask must already be selected on
+ * the root window, so that no change is missed.
+ */
+void snap_init(struct snap *snap, Display *display);
+
+void snap_free(struct snap *snap);
+
+/* Return whether `event` was about a top-level window (and update) */
+int snap_process_event(struct snap *snap, XEvent *event);
+
+/*
+ * Move (x, y) to the nearest line in direction (dx, dy), one of them 0 and
+ * the other -1 or 1. Only lines that cross the pointer count. Return -1 if
+ * there is none.
+ */
+int snap_target(const struct snap *snap, int dx, int dy, int *x, int *y);
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stats.h"
+
+struct histogram {
+    unsigned long count;
+    unsigned long sum;
+    unsigned long max;
+    unsigned long buckets[STATS_BUCKETS];
+};
+
+static const char *counter_names[STATS_COUNTERS] = {
+    [STATS_KEY_EVENTS]   = "key_events",
+    [STATS_CLICKS]       = "clicks",
+    [STATS_MOVES]        = "moves",
+    [STATS_SCROLLS]      = "scrolls",
+    [STATS_TICKS]        = "ticks",
+    [STATS_MISSED_TICKS] = "missed_ticks"
+};
+
+static const char *histogram_names[STATS_HISTOGRAMS] = {
+    [STATS_EVENT_DELIVERY]   = "event_delivery_ms",
+    [STATS_EVENT_PROCESSING] = "event_processing_us",
+    [STATS_TICK_JITTER]      = "tick_jitter_us",
+    [STATS_TICK_REQUESTS]    = "tick_requests",
+    [STATS_TICK_ROUND_TRIPS] = "tick_round_trips"
+};
+
+static unsigned long counters[STATS_COUNTERS];
+
+static struct histogram histograms[STATS_HISTOGRAMS];
+
+#define LOAD(x)      __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define ADD(x, n)    __atomic_fetch_add(&(x), (n), __ATOMIC_RELAXED)
+
+void stats_count(enum stats_counter counter, unsigned long n)
+{
+    ADD(counters[counter], n);
+}
+
+void stats_record(enum stats_histogram histogram, unsigned long value)
+{
+    struct histogram *h = &histograms[histogram];
+    unsigned long max = LOAD(h->max);
+    int bucket = value ? 8 * sizeof(value) - __builtin_clzl(value) : 0;
+
+    if (bucket >= STATS_BUCKETS)
+        bucket = STATS_BUCKETS - 1;
+
+    ADD(h->count, 1);
+    ADD(h->sum, value);
+    ADD(h->buckets[bucket], 1);
+
+    while (value > max &&
+           !__atomic_compare_exchange_n(&h->max, &max, value, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/*
+ * Upper bound of the bucket holding the `per_mille` quantile: accurate to a
+ * factor of two, which is enough to tell 50 us of jitter from 5 ms.
+ */
+static unsigned long percentile(const unsigned long *buckets,
+                                unsigned long count, int per_mille)
+{
+    unsigned long rank = (count * per_mille + 999) / 1000, seen = 0;
+    int i;
+
+    for (i = 0; i < STATS_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank)
+            return i ? (1UL << i) - 1 : 0;
+    }
+    return ~0UL;
+}
+
+void stats_dump(FILE *stream)
+{
+    int i, j;
+
+    fprintf(stream, "{\"counters\": {");
+    for (i = 0; i < STATS_COUNTERS; i++)
+        fprintf(stream, "%s\"%s\": %lu", i ? ", " : "", counter_names[i],
+                LOAD(counters[i]));
+
+    fprintf(stream, "}, \"histograms\": {");
+    for (i = 0; i < STATS_HISTOGRAMS; i++) {
+        struct histogram *h = &histograms[i];
+        unsigned long buckets[STATS_BUCKETS], count = 0;
+
+        // Counts may change meanwhile: percentiles use this copy
+        for (j = 0; j < STATS_BUCKETS; j++)
+            count += buckets[j] = LOAD(h->buckets[j]);
+
+        fprintf(stream, "%s\"%s\": {\"count\": %lu, \"sum\": %lu, "
+                "\"max\": %lu, ", i ? ", " : "", histogram_names[i],
+                LOAD(h->count), LOAD(h->sum), LOAD(h->max));
+        if (count)
+            fprintf(stream, "\"p50\": %lu, \"p90\": %lu, \"p99\": %lu, ",
+                    percentile(buckets, count, 500),
+                    percentile(buckets, count, 900),
+                    percentile(buckets, count, 990));
+        fprintf(stream, "\"buckets\": [");
+        for (j = 0; j < STATS_BUCKETS; j++)
+            fprintf(stream, "%s%lu", j ? ", " : "", buckets[j]);
+        fprintf(stream, "]}");
+    }
+
+    fprintf(stream, "}}\n");
+    fflush(stream);
+}
@@ -0,0 +1,63 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdio.h>
+
+/*
+ * Counters and latency histograms. Recording is a few relaxed atomic
+ * additions on static storage: no allocation, no lock, cheap enough to stay
+ * enabled. Histograms have fixed power-of-two buckets: bucket i counts
+ * values in [2^(i-1), 2^i), bucket 0 counts zeros.
+ */
+
+enum stats_counter {
+    STATS_KEY_EVENTS,
+    STATS_CLICKS,
+    STATS_MOVES,
+    STATS_SCROLLS,
+    STATS_TICKS,
+    STATS_MISSED_TICKS,
+
+    STATS_COUNTERS
+};
+
+enum stats_histogram {
+    STATS_EVENT_DELIVERY,    /* ms, from server timestamp to reception */
+    STATS_EVENT_PROCESSING,  /* us, from reception to requests flushed */
+    STATS_TICK_JITTER,       /* us, from tick deadline to wakeup */
+    STATS_TICK_REQUESTS,     /* X requests sent per tick */
+    STATS_TICK_ROUND_TRIPS,  /* X round-trips per tick */
+
+    STATS_HISTOGRAMS
+};
+
+#define STATS_BUCKETS  32
+
+void stats_count(enum stats_counter counter, unsigned long n);
+
+void stats_record(enum stats_histogram histogram, unsigned long value);
+
+/*
+ * Write all statistics as one line of JSON. Histograms also get their 50th,
+ * 90th and 99th percentiles, rounded up to a bucket bound.
+ */
+void stats_dump(FILE *stream);
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "uinput.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/uinput.h>
+#include <sys/ioctl.h>
+
+#define UINPUT_PATH  "/dev/uinput"
+
+// Enough for a tick: motion, a few button edges, their SYN_REPORTs
+#define MAX_EVENTS   64
+
+// Motion and wheel events of a frame, its button edge and SYN_REPORT
+#define FRAME_EVENTS  8
+
+// High-resolution wheel units per click
+#define WHEEL_UNIT   120
+
+static int fd = -1;
+
+static struct input_event events[MAX_EVENTS];
+static int n_events;
+
+// Motion not queued yet: all moves of a frame are summed
+static int pending_dx, pending_dy;
+
+// Same for wheels, in WHEEL_UNITs. Positive is up for REL_WHEEL.
+static int pending_wheel, pending_hwheel;
+
+// High-resolution motion not reported as whole clicks yet
+static int wheel_units, hwheel_units;
+
+static const unsigned short buttons[] = {
+    [1] = BTN_LEFT,
+    [2] = BTN_MIDDLE,
+    [3] = BTN_RIGHT
+};
+
+int uinput_open()
+{
+    struct uinput_setup setup;
+    int i;
+
+    fd = open(UINPUT_PATH, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        perror("Cannot open " UINPUT_PATH);
+        return -1;
+    }
+
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_VIRTUAL;
+    strncpy(setup.name, "mousemode pointer", UINPUT_MAX_NAME_SIZE - 1);
+
+    if (ioctl(fd, UI_SET_EVBIT, EV_SYN) || ioctl(fd, UI_SET_EVBIT, EV_KEY) ||
+        ioctl(fd, UI_SET_EVBIT, EV_REL) || ioctl(fd, UI_SET_RELBIT, REL_X) ||
+        ioctl(fd, UI_SET_RELBIT, REL_Y) ||
+        ioctl(fd, UI_SET_RELBIT, REL_WHEEL) ||
+        ioctl(fd, UI_SET_RELBIT, REL_WHEEL_HI_RES) ||
+        ioctl(fd, UI_SET_RELBIT, REL_HWHEEL) ||
+        ioctl(fd, UI_SET_RELBIT, REL_HWHEEL_HI_RES)) {
+        perror("uinput ioctl");
+        goto err;
+    }
+    for (i = 1; i < sizeof(buttons) / sizeof(buttons[0]); i++) {
+        if (ioctl(fd, UI_SET_KEYBIT, buttons[i])) {
+            perror("uinput ioctl");
+            goto err;
+        }
+    }
+
+    if (ioctl(fd, UI_DEV_SETUP, &setup) || ioctl(fd, UI_DEV_CREATE)) {
+        perror("Cannot create uinput device");
+        goto err;
+    }
+
+    return 0;
+
+err:
+    close(fd);
+    fd = -1;
+    return -1;
+}
+
+static int write_events()
+{
+    ssize_t size;
+
+    if (!n_events)
+        return 0;
+
+    size = write(fd, events, n_events * sizeof(events[0]));
+    if (size < 0)
+        perror("uinput write");
+    n_events = 0;
+
+    return 1;
+}
+
+static void queue_event(unsigned short type, unsigned short code, int value)
+{
+    if (n_events == MAX_EVENTS)
+        write_events();
+
+    memset(&events[n_events], 0, sizeof(events[n_events]));
+    events[n_events].type = type;
+    events[n_events].code = code;
+    events[n_events].value = value;
+    n_events++;
+}
+
+/*
+ * Like real high-resolution mice, also send the legacy wheel events, once a
+ * whole click is reached, for clients that only know about them.
+ */
+static void queue_wheel(unsigned short code, unsigned short hires_code,
+                        int value, int *units)
+{
+    if (!value)
+        return;
+
+    queue_event(EV_REL, hires_code, value);
+
+    *units += value;
+    if (*units / WHEEL_UNIT) {
+        queue_event(EV_REL, code, *units / WHEEL_UNIT);
+        *units %= WHEEL_UNIT;
+    }
+}
+
+static void queue_motion()
+{
+    if (pending_dx)
+        queue_event(EV_REL, REL_X, pending_dx);
+    if (pending_dy)
+        queue_event(EV_REL, REL_Y, pending_dy);
+    pending_dx = pending_dy = 0;
+
+    queue_wheel(REL_WHEEL, REL_WHEEL_HI_RES, pending_wheel, &wheel_units);
+    queue_wheel(REL_HWHEEL, REL_HWHEEL_HI_RES, pending_hwheel,
+                &hwheel_units);
+    pending_wheel = pending_hwheel = 0;
+}
+
+/*
+ * A button edge ends the frame: a press and its release in the same frame
+ * would be seen as no click at all.
+ */
+static void queue_button(unsigned int button, int value)
+{
+    if (button >= sizeof(buttons) / sizeof(buttons[0]) || !buttons[button])
+        return;
+
+    // Leave room for the whole frame, so it is written at once
+    if (n_events > MAX_EVENTS - FRAME_EVENTS)
+        write_events();
+
+    queue_motion();
+    queue_event(EV_KEY, buttons[button], value);
+    queue_event(EV_SYN, SYN_REPORT, 0);
+}
+
+void uinput_press_button(unsigned int button)
+{
+    queue_button(button, 1);
+}
+
+void uinput_release_button(unsigned int button)
+{
+    queue_button(button, 0);
+}
+
+void uinput_move(int dx, int dy)
+{
+    pending_dx += dx;
+    pending_dy += dy;
+}
+
+void uinput_scroll(double dx, double dy)
+{
+    pending_wheel -= lround(dy * WHEEL_UNIT);
+    pending_hwheel += lround(dx * WHEEL_UNIT);
+}
+
+int uinput_flush()
+{
+    if (pending_dx || pending_dy || pending_wheel || pending_hwheel) {
+        if (n_events > MAX_EVENTS - FRAME_EVENTS)
+            write_events();
+        queue_motion();
+        queue_event(EV_SYN, SYN_REPORT, 0);
+    }
+
+    return write_events();
+}
@@ -0,0 +1,51 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UINPUT_H
+#define _UINPUT_H
+
+/*
+ * uinput output backend: a virtual relative pointer device created through
+ * /dev/uinput. Motion is summed and written with button events in a single
+ * write() per flush; each frame ends with one SYN_REPORT.
+ *
+ * Buttons are X button numbers (1: left, 2: middle, 3: right). Scrolling
+ * uses the high-resolution wheel axes (1/120 of a click), that the X server
+ * turns into XI2 smooth scrolling.
+ *
+ * The server accelerates this motion like that of any mouse: the position
+ * tracked by mouse.c is only right again once queried, which the raw motion
+ * of the device triggers. Until then (a batch of X events), moves are
+ * clamped to monitors from where we thought the pointer was. Targets (jump,
+ * monitors, snapping, `moveto`) are not moved to through uinput, but with
+ * absolute XTest motion (see mouse.c).
+ */
+
+int uinput_open();
+
+void uinput_press_button(unsigned int button);
+
+void uinput_release_button(unsigned int button);
+
+void uinput_move(int dx, int dy);
+
+/* In wheel clicks, fractions allowed: positive is down and right */
+void uinput_scroll(double dx, double dy);
+
+int uinput_flush();
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "xinput.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <X11/extensions/XInput2.h>
+
+int xinput_init(Display *display)
+{
+    // 2.1: raw events reach the root window even while a grab is active
+    int opcode, event, error, major = 2, minor = 1;
+
+    if (!XQueryExtension(display, "XInputExtension",
+                         &opcode, &event, &error)) {
+        fprintf(stderr, "XInput extension not available\n");
+        return -1;
+    }
+
+    if (XIQueryVersion(display, &major, &minor) != Success) {
+        fprintf(stderr, "XInput 2 not supported (server has %d.%d)\n",
+                major, minor);
+        return -1;
+    }
+
+    return opcode;
+}
+
+void xinput_grab_keys(Display *display, const KeyCode *keycodes, int n)
+{
+    unsigned char mask_bits[XIMaskLen(XI_LASTEVENT)] = { 0 };
+    XIEventMask mask = {
+        .deviceid = XIAllMasterDevices,
+        .mask_len = sizeof(mask_bits),
+        .mask = mask_bits
+    };
+    XIGrabModifiers modifiers = { .modifiers = XIAnyModifier };
+    int i;
+
+    XISetMask(mask_bits, XI_KeyPress);
+    XISetMask(mask_bits, XI_KeyRelease);
+
+    for (i = 0; i < n; i++) {
+        if (!keycodes[i])
+            continue;
+        XIGrabKeycode(display, XIAllMasterDevices, keycodes[i],
+                      DefaultRootWindow(display), GrabModeAsync,
+                      GrabModeAsync, False, &mask, 1, &modifiers);
+    }
+}
+
+void xinput_select_raw_events(Display *display, int enable)
+{
+    unsigned char mask_bits[XIMaskLen(XI_LASTEVENT)] = { 0 };
+    XIEventMask mask = {
+        .deviceid = XIAllMasterDevices,
+        .mask_len = sizeof(mask_bits),
+        .mask = mask_bits
+    };
+
+    if (enable) {
+        XISetMask(mask_bits, XI_RawKeyRelease);
+        XISetMask(mask_bits, XI_RawMotion);
+    }
+
+    XISelectEvents(display, DefaultRootWindow(display), &mask, 1);
+}
+
+void xinput_ungrab_keys(Display *display, const KeyCode *keycodes, int n)
+{
+    XIGrabModifiers modifiers = { .modifiers = XIAnyModifier };
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (!keycodes[i])
+            continue;
+        XIUngrabKeycode(display, XIAllMasterDevices, keycodes[i],
+                        DefaultRootWindow(display), 1, &modifiers);
+    }
+}
+
+int xinput_event(Display *display, int opcode, XEvent *event,
+                 struct xinput_event *result)
+{
+    XGenericEventCookie *cookie = &event->xcookie;
+    XIDeviceEvent *xievent;
+    XIRawEvent *raw;
+    int ret = 0;
+
+    if (cookie->type != GenericEvent || cookie->extension != opcode ||
+        !XGetEventData(display, cookie))
+        return 0;
+
+    memset(result, 0, sizeof(*result));
+
+    switch (cookie->evtype) {
+    case XI_KeyPress:
+    case XI_KeyRelease:
+        xievent = cookie->data;
+        if (xievent->flags & XIKeyRepeat)
+            break;
+        result->type = cookie->evtype == XI_KeyPress ? KeyPress : KeyRelease;
+        result->keycode = xievent->detail;
+        result->modifiers = xievent->mods.effective;
+        result->time = xievent->time;
+        ret = 1;
+        break;
+    case XI_RawKeyRelease:
+    case XI_RawMotion:
+        raw = cookie->data;
+        result->type = cookie->evtype == XI_RawMotion ? MotionNotify :
+                                                         KeyRelease;
+        result->keycode = cookie->evtype == XI_RawMotion ? 0 : raw->detail;
+        result->time = raw->time;
+        ret = 1;
+        break;
+    }
+
+    XFreeEventData(display, cookie);
+    return ret;
+}
+
+/* Return the device id of master pointer `name`, or -1 */
+static int find_master_pointer(Display *display, const char *name)
+{
+    XIDeviceInfo *devices;
+    int i, n, id = -1;
+
+    devices = XIQueryDevice(display, XIAllMasterDevices, &n);
+    for (i = 0; i < n; i++)
+        if (devices[i].use == XIMasterPointer &&
+            !strcmp(devices[i].name, name))
+            id = devices[i].deviceid;
+    XIFreeDeviceInfo(devices);
+
+    return id;
+}
+
+int xinput_master_pointer(Display *display, const char *name, int *created)
+{
+    XIAddMasterInfo add = {
+        .type = XIAddMaster,
+        .name = (char *) name,
+        .send_core = True,
+        .enable = True
+    };
+    char pointer_name[128];
+    int id;
+
+    // The server names the new pair "NAME pointer" and "NAME keyboard"
+    snprintf(pointer_name, sizeof(pointer_name), "%s pointer", name);
+
+    *created = 0;
+    id = find_master_pointer(display, pointer_name);
+    if (id >= 0)
+        return id;
+
+    if (XIChangeHierarchy(display, (XIAnyHierarchyChangeInfo *) &add,
+                          1) != Success) {
+        fprintf(stderr, "Cannot create master pointer %s\n", name);
+        return -1;
+    }
+
+    // The query is a round-trip: the change is done by then
+    id = find_master_pointer(display, pointer_name);
+    if (id < 0) {
+        fprintf(stderr, "Cannot create master pointer %s\n", name);
+        return -1;
+    }
+
+    *created = 1;
+    return id;
+}
+
+void xinput_remove_master(Display *display, int id)
+{
+    XIRemoveMasterInfo remove = {
+        .type = XIRemoveMaster,
+        .deviceid = id,
+        .return_mode = XIFloating
+    };
+
+    XIChangeHierarchy(display, (XIAnyHierarchyChangeInfo *) &remove, 1);
+}
+
+int xinput_set_client_pointer(Display *display, int id)
+{
+    // None: for the whole connection
+    if (XISetClientPointer(display, None, id) != Success) {
+        fprintf(stderr, "Cannot use device %d as client pointer\n", id);
+        return -1;
+    }
+    return 0;
+}
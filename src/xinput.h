@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _XINPUT_H
+#define _XINPUT_H
+
+#include <X11/Xlib.h>
+
+/*
+ * XInput2 key input: passive grabs on the bound keys only (instead of
+ * grabbing the whole keyboard, see Design.md), with autorepeat flagged by
+ * the server instead of faked release/press pairs.
+ */
+
+/* Return the XI2 extension opcode of the display, or -1 without XI2 */
+int xinput_init(Display *display);
+
+void xinput_grab_keys(Display *display, const KeyCode *keycodes, int n);
+
+void xinput_ungrab_keys(Display *display, const KeyCode *keycodes, int n);
+
+/*
+ * Raw events of master devices, on the root window: they reach it whatever
+ * the grabs and whatever window is under the pointer.
+ *
+ * A passive grab ends with the release of the key that activated it: keys
+ * pressed meanwhile are released to the focused client. Raw releases are
+ * not lost this way, but grabbed keys are then released twice.
+ *
+ * Root MotionNotify events only come when no window under the pointer takes
+ * them: raw motion tells whenever a pointer moves, though not where to.
+ */
+void xinput_select_raw_events(Display *display, int enable);
+
+struct xinput_event {
+    int type;                /* KeyPress, KeyRelease or MotionNotify */
+    KeyCode keycode;
+    unsigned int modifiers;  /* X masks, none for raw events */
+    Time time;               /* server timestamp */
+};
+
+/*
+ * Fill `result` if `event` is an XI2 key or raw motion event. Autorepeats
+ * are dropped.
+ */
+int xinput_event(Display *display, int opcode, XEvent *event,
+                 struct xinput_event *result);
+
+/*
+ * Multi-pointer X: find master pointer `name`, or create it with its own
+ * XTest devices. Return its device id, or -1. `created` tells whether
+ * xinput_remove_master() should be called once done.
+ */
+int xinput_master_pointer(Display *display, const char *name, int *created);
+
+/* Slaves of the removed master float */
+void xinput_remove_master(Display *display, int id);
+
+/*
+ * Core requests of this connection (XTest input, WarpPointer, QueryPointer)
+ * then go to master pointer `id`. Return -1 on error.
+ */
+int xinput_set_client_pointer(Display *display, int id);
+
+#endif
@@ -0,0 +1,343 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark driver: plays scripted key sequences through XTest against a
+ * running mousemode, watches the pointer from the root window and the
+ * mousemode process from /proc, and prints results as JSON. Fails if a
+ * released key keeps the pointer moving.
+ *
+ * Usage: driver <mousemode pid> <mousemode log file>
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+
+#define TAPS           50
+#define HOLD_DURATION  1000   /* ms */
+#define IDLE_DURATION  2000   /* ms */
+#define MAX_SAMPLES    1024
+
+static Display *display;
+static pid_t pid;
+
+struct usage {
+    unsigned long time;      /* us */
+    double cpu;              /* seconds */
+    unsigned long switches;  /* voluntary + involuntary */
+};
+
+struct sample {
+    unsigned long time;  /* us */
+    int x, y;
+};
+
+static unsigned long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void read_usage(struct usage *usage)
+{
+    char path[64], line[256];
+    unsigned long utime, stime, n;
+    FILE *f;
+
+    usage->time = now_us();
+    usage->cpu = 0;
+    usage->switches = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if ((f = fopen(path, "r"))) {
+        // Fields 14 and 15, after the command name in parentheses
+        if (fgets(line, sizeof(line), f) && strrchr(line, ')') &&
+            sscanf(strrchr(line, ')') + 2, "%*c %*d %*d %*d %*d %*d %*u "
+                   "%*u %*u %*u %*u %lu %lu", &utime, &stime) == 2)
+            usage->cpu = (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+        fclose(f);
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    if ((f = fopen(path, "r"))) {
+        while (fgets(line, sizeof(line), f))
+            if (sscanf(line, "voluntary_ctxt_switches: %lu", &n) == 1 ||
+                sscanf(line, "nonvoluntary_ctxt_switches: %lu", &n) == 1)
+                usage->switches += n;
+        fclose(f);
+    }
+}
+
+static void print_usage(const char *name, const struct usage *before,
+                        const struct usage *after)
+{
+    double duration = (after->time - before->time) / 1e6;
+
+    printf("\"%s\": {\"duration_s\": %.3f, \"cpu_s_per_s\": %.6f, "
+           "\"wakeups_per_s\": %.2f}", name, duration,
+           (after->cpu - before->cpu) / duration,
+           (after->switches - before->switches) / duration);
+}
+
+static int compare(const void *a, const void *b)
+{
+    unsigned long x = *(const unsigned long *) a,
+                  y = *(const unsigned long *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_distribution(const char *name, unsigned long *values,
+                               int n)
+{
+    qsort(values, n, sizeof(values[0]), compare);
+
+    printf("\"%s\": {\"samples\": %d", name, n);
+    if (n)
+        printf(", \"p50\": %lu, \"p90\": %lu, \"p99\": %lu, \"max\": %lu",
+               values[n / 2], values[n * 9 / 10], values[n * 99 / 100],
+               values[n - 1]);
+    printf("}");
+}
+
+static void key(KeySym keysym, Bool press)
+{
+    XTestFakeKeyEvent(display, XKeysymToKeycode(display, keysym), press,
+                      CurrentTime);
+    XFlush(display);
+}
+
+/* Wait for an event of type `type` until `deadline` (us) */
+static int wait_event(int type, unsigned long deadline, XEvent *event)
+{
+    int fd = ConnectionNumber(display);
+
+    while (1) {
+        unsigned long now = now_us();
+        struct timeval tv;
+        fd_set fds;
+
+        while (XPending(display)) {
+            XNextEvent(display, event);
+            if (event->type == type)
+                return 1;
+        }
+
+        if (now >= deadline)
+            return 0;
+
+        tv.tv_sec = (deadline - now) / 1000000;
+        tv.tv_usec = (deadline - now) % 1000000;
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        select(fd + 1, &fds, NULL, NULL, &tv);
+    }
+}
+
+/* Discard all events for `duration` ms */
+static void drain_events(unsigned long duration)
+{
+    XEvent event;
+
+    // No event has type LASTEvent: this returns at the deadline
+    wait_event(LASTEvent, now_us() + duration * 1000, &event);
+}
+
+static void idle(const char *name)
+{
+    struct usage before, after;
+
+    read_usage(&before);
+    usleep(IDLE_DURATION * 1000);
+    read_usage(&after);
+
+    print_usage(name, &before, &after);
+}
+
+/* Time from a key press to the resulting pointer event */
+static void taps(const char *name, KeySym keysym, int type)
+{
+    unsigned long latencies[TAPS];
+    int i, n = 0;
+
+    for (i = 0; i < TAPS; i++) {
+        unsigned long start = now_us();
+        XEvent event;
+
+        key(keysym, True);
+        key(keysym, False);
+        if (wait_event(type, start + 500000, &event))
+            latencies[n++] = now_us() - start;
+
+        drain_events(30);
+    }
+
+    print_distribution(name, latencies, n);
+}
+
+static void hold()
+{
+    static struct sample samples[MAX_SAMPLES];
+    static unsigned long intervals[MAX_SAMPLES];
+    struct usage before, after;
+    unsigned long start, deadline;
+    XEvent event;
+    int i, n = 0;
+
+    XWarpPointer(display, None, DefaultRootWindow(display), 0, 0, 0, 0,
+                 100, 100);
+    drain_events(100);
+
+    read_usage(&before);
+    start = now_us();
+    deadline = start + HOLD_DURATION * 1000;
+    key(XK_L, True);
+    while (n < MAX_SAMPLES && wait_event(MotionNotify, deadline, &event)) {
+        samples[n].time = now_us() - start;
+        samples[n].x = event.xmotion.x_root;
+        samples[n].y = event.xmotion.y_root;
+        n++;
+    }
+    key(XK_L, False);
+    read_usage(&after);
+    drain_events(100);
+
+    for (i = 1; i < n; i++)
+        intervals[i - 1] = samples[i].time - samples[i - 1].time;
+
+    printf("\"hold\": {");
+    print_usage("usage", &before, &after);
+    printf(", \"distance_px\": %d, ", n ? samples[n - 1].x - 100 : 0);
+    print_distribution("motion_interval_us", intervals, n ? n - 1 : 0);
+    printf(", \"trajectory\": [");
+    for (i = 0; i < n; i++)
+        printf("%s[%lu, %d, %d]", i ? ", " : "", samples[i].time / 1000,
+               samples[i].x, samples[i].y);
+    printf("]}");
+}
+
+/*
+ * Release the key that activated a passive grab before another held key:
+ * the pointer must stop anyway. Return whether it kept moving.
+ */
+static int rollover()
+{
+    Window root, child;
+    int x, y, stopped_x, stopped_y, win_x, win_y;
+    unsigned int mask;
+
+    key(XK_H, True);
+    key(XK_J, True);
+    drain_events(200);
+    key(XK_H, False);
+    key(XK_J, False);
+    drain_events(200);
+
+    XQueryPointer(display, DefaultRootWindow(display), &root, &child,
+                  &stopped_x, &stopped_y, &win_x, &win_y, &mask);
+    drain_events(300);
+    XQueryPointer(display, DefaultRootWindow(display), &root, &child, &x, &y,
+                  &win_x, &win_y, &mask);
+
+    printf("\"rollover_stuck\": %s", x != stopped_x || y != stopped_y ?
+           "true" : "false");
+    return x != stopped_x || y != stopped_y;
+}
+
+/* Ask mousemode for its own statistics and copy them from its log */
+static void mousemode_stats(const char *log)
+{
+    char line[8192], last[8192] = "{}";
+    FILE *f;
+
+    kill(pid, SIGUSR1);
+    usleep(200000);
+
+    if ((f = fopen(log, "r"))) {
+        while (fgets(line, sizeof(line), f))
+            if (line[0] == '{')
+                strcpy(last, line);
+        fclose(f);
+    }
+    last[strcspn(last, "\n")] = '\0';
+
+    printf("\"mousemode_stats\": %s", last);
+}
+
+int main(int argc, char **argv)
+{
+    int stuck;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <mousemode pid> <log file>\n", argv[0]);
+        exit(1);
+    }
+    pid = atoi(argv[1]);
+
+    display = XOpenDisplay(NULL);
+    if (display == NULL) {
+        fprintf(stderr, "Cannot XOpenDisplay\n");
+        exit(1);
+    }
+
+    // Without any window, the root window gets all pointer events
+    XSelectInput(display, DefaultRootWindow(display),
+                 PointerMotionMask | ButtonPressMask);
+    XWarpPointer(display, None, DefaultRootWindow(display), 0, 0, 0, 0,
+                 100, 100);
+
+    printf("{");
+    idle("idle_normal_mode");
+
+    // Ctrl + Super + Alt to enter mouse mode
+    key(XK_Control_L, True);
+    key(XK_Super_L, True);
+    key(XK_Alt_L, True);
+    key(XK_Alt_L, False);
+    key(XK_Super_L, False);
+    key(XK_Control_L, False);
+    drain_events(200);
+
+    printf(", ");
+    idle("idle_mouse_mode");
+    printf(", ");
+    taps("move_latency_us", XK_L, MotionNotify);
+    printf(", ");
+    taps("click_latency_us", XK_F, ButtonPress);
+    printf(", ");
+    hold();
+    printf(", ");
+    stuck = rollover();
+    key(XK_Escape, True);
+    key(XK_Escape, False);
+    drain_events(200);
+
+    printf(", ");
+    mousemode_stats(argv[2]);
+    printf("}\n");
+
+    XCloseDisplay(display);
+    return stuck ? EXIT_FAILURE : EXIT_SUCCESS;
+}
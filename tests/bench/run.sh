@@ -0,0 +1,51 @@
+#!/bin/bash
+# Copyright (C) 2015 Adrien Vergé
+#
+# Run mousemode against a private Xvfb server and benchmark it.
+# Usage: run.sh <mousemode binary> <driver binary> [output.json]
+# Options for mousemode can be given in $MOUSEMODE_ARGS, e.g. --realtime.
+
+mousemode=$1
+driver=$2
+output=${3:-bench.json}
+
+# Check that Xvfb is installed
+if ! which Xvfb &>/dev/null; then
+  echo "error: Xvfb is not installed" >&2
+  exit 1
+fi
+
+# Find a free display number
+display=99
+while [ -e /tmp/.X11-unix/X$display ] || [ -e /tmp/.X$display-lock ]; do
+  display=$((display + 1))
+done
+
+log=$(mktemp)
+
+Xvfb :$display -screen 0 1920x1080x24 -nolisten tcp &>/dev/null &
+xvfb=$!
+trap 'kill $mousemode_pid $xvfb 2>/dev/null; rm -f $log' EXIT
+
+for i in $(seq 50); do
+  [ -e /tmp/.X11-unix/X$display ] && break
+  sleep 0.1
+done
+
+# Not the user's own config: bindings and acceleration change the results
+DISPLAY=:$display $mousemode --config "$(dirname "$0")/config.yml" \
+  $MOUSEMODE_ARGS >$log 2>&1 &
+mousemode_pid=$!
+sleep 0.5
+
+if ! kill -0 $mousemode_pid 2>/dev/null; then
+  echo "error: mousemode did not start" >&2
+  cat $log >&2
+  exit 1
+fi
+
+DISPLAY=:$display $driver $mousemode_pid $log >$output
+rc=$?
+
+[ $rc -eq 0 ] && echo "Results written to $output"
+exit $rc
@@ -0,0 +1,115 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of the keyboard state machine, with a fake clock:
+ *
+ *   - event: process_keyboard_event() then compute_pointer_clicks(), for a
+ *     key press or release,
+ *   - tick: compute_pointer_movement() with two movement keys held.
+ *
+ * Usage: bench [ITERATIONS]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "keyboard.h"
+
+static unsigned long now;
+
+static unsigned long test_milliseconds()
+{
+    return now;
+}
+
+static unsigned long long nanoseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void setup(struct keyboard *kb)
+{
+    KeyCode keycodes[BINDING_COUNT] = { 0 };
+    int i;
+
+    keyboard_init(kb, test_milliseconds);
+    set_detectable_autorepeat(kb, 1);
+    for (i = BINDING_NONE + 1; i < BINDING_COUNT; i++)
+        keycodes[i] = 10 + i;
+    set_keycodes(kb, keycodes);
+}
+
+static double bench_events(struct keyboard *kb, unsigned long iterations)
+{
+    static const enum binding keys[] = {
+        BINDING_LCLICK, BINDING_RIGHT, BINDING_PRECISION, BINDING_DOWN
+    };
+    struct pointer_click clicks[4];
+    unsigned long long start;
+    unsigned long i;
+
+    setup(kb);
+    now = 1000;
+
+    start = nanoseconds();
+    for (i = 0; i < iterations; i++) {
+        now += 5;
+        process_keyboard_event(kb, i & 4 ? KeyRelease : KeyPress,
+                               10 + keys[i & 3], now);
+        compute_pointer_clicks(kb, clicks, 4);
+    }
+
+    return (double) (nanoseconds() - start) / iterations;
+}
+
+static double bench_ticks(struct keyboard *kb, unsigned long iterations)
+{
+    struct pointer_click clicks[4];
+    unsigned long long start;
+    unsigned long i;
+    int dx, dy;
+
+    setup(kb);
+    now = 1000;
+    process_keyboard_event(kb, KeyPress, 10 + BINDING_RIGHT, now);
+    process_keyboard_event(kb, KeyPress, 10 + BINDING_DOWN, now);
+    compute_pointer_clicks(kb, clicks, 4);
+
+    start = nanoseconds();
+    for (i = 0; i < iterations; i++) {
+        now += 20;
+        compute_pointer_movement(kb, &dx, &dy);
+    }
+
+    return (double) (nanoseconds() - start) / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    static struct keyboard kb;
+    unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 0) :
+                               10000000;
+
+    printf("{\"event_ns\": %.1f, ", bench_events(&kb, iterations));
+    printf("\"tick_ns\": %.1f}\n", bench_ticks(&kb, iterations));
+
+    return EXIT_SUCCESS;
+}
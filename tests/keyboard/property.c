@@ -0,0 +1,338 @@
+/*
+ *  Copyright (C) 2015 Adrien Vergé
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Randomized property tests of the keyboard state machine: generate arbitrary
+ * press/release interleavings (with autorepeat, split batches, releases of
+ * keys pressed before mouse mode), feed them the way session.c does, and
+ * check:
+ *
+ *   - the impossible branches of the click logic are never reached,
+ *   - button presses and releases alternate,
+ *   - once all keys are released, no button is down and nothing moves,
+ *   - the same scenario always gives the same output,
+ *   - the total movement does not depend on the tick period (1 pixel of
+ *     rounding per movement).
+ *
+ * Usage: property [SCENARIOS [SEED]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "keyboard.h"
+
+#define MAX_EVENTS  4096
+
+#define BATCH       0  /* not a key event: end of a batch of X events */
+
+struct event {
+    unsigned long time;
+    int type;
+    KeyCode keycode;
+};
+
+struct scenario {
+    int detectable_autorepeat;
+    int n_events;
+    struct event events[MAX_EVENTS];
+    int movements;  /* number of times all movement keys are released */
+};
+
+struct result {
+    long x, y;
+    unsigned long presses, releases;
+    unsigned long hash;
+    int failed;
+};
+
+static const enum binding bound[] = {
+    BINDING_UP, BINDING_DOWN, BINDING_LEFT, BINDING_RIGHT,
+    BINDING_LCLICK, BINDING_MCLICK, BINDING_RCLICK,
+    BINDING_PRECISION
+};
+
+#define N_BOUND  (sizeof(bound) / sizeof(bound[0]))
+
+static unsigned long now;
+
+static unsigned long test_milliseconds()
+{
+    return now;
+}
+
+static unsigned long long rng;
+
+static unsigned int random_below(unsigned int n)
+{
+    // xorshift64*
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (rng * 2685821657736338717ULL >> 32) % n;
+}
+
+static KeyCode keycode_of(enum binding binding)
+{
+    return 10 + binding;
+}
+
+static int is_movement_key(enum binding binding)
+{
+    return binding >= BINDING_UP && binding <= BINDING_RIGHT;
+}
+
+static void add_event(struct scenario *s, unsigned long time, int type,
+                      KeyCode keycode)
+{
+    if (s->n_events == MAX_EVENTS)
+        return;
+    s->events[s->n_events].time = time;
+    s->events[s->n_events].type = type;
+    s->events[s->n_events].keycode = keycode;
+    s->n_events++;
+}
+
+static void generate(struct scenario *s, int detectable_autorepeat)
+{
+    unsigned long time = 1000, held_since[BINDING_COUNT] = { 0 },
+                  repeated[BINDING_COUNT] = { 0 };
+    int down[BINDING_COUNT] = { 0 };
+    int steps = 20 + random_below(200), i, j, moving = 0;
+
+    memset(s, 0, sizeof(*s));
+    s->detectable_autorepeat = detectable_autorepeat;
+
+    for (i = 0; i < steps; i++) {
+        enum binding binding = bound[random_below(N_BOUND)];
+        KeyCode keycode = keycode_of(binding);
+
+        time += random_below(4) ? random_below(80) : 0;
+
+        // Autorepeat of held keys, as X sends it
+        for (j = 0; j < N_BOUND; j++) {
+            enum binding b = bound[j];
+
+            if (!down[b] || time - held_since[b] < 300 ||
+                time - repeated[b] < 33)
+                continue;
+            repeated[b] = time;
+            if (!detectable_autorepeat)
+                add_event(s, time, KeyRelease, keycode_of(b));
+            add_event(s, time + random_below(2), KeyPress, keycode_of(b));
+            if (!random_below(4))
+                add_event(s, time, BATCH, 0);
+        }
+
+        if (down[binding]) {
+            add_event(s, time, KeyRelease, keycode);
+            down[binding] = 0;
+        } else if (!random_below(8)) {
+            // Key pressed before entering mouse mode
+            add_event(s, time, KeyRelease, keycode);
+        } else {
+            add_event(s, time, KeyPress, keycode);
+            down[binding] = 1;
+            held_since[binding] = repeated[binding] = time;
+        }
+
+        // Events are delivered as they happen: movement computed by ticks
+        // in between would otherwise depend on the tick period
+        add_event(s, time, BATCH, 0);
+
+        if (moving && !down[BINDING_UP] && !down[BINDING_DOWN] &&
+            !down[BINDING_LEFT] && !down[BINDING_RIGHT])
+            s->movements++;
+        moving = 0;
+        for (j = 0; j < N_BOUND; j++)
+            moving |= down[bound[j]] && is_movement_key(bound[j]);
+    }
+
+    // Release everything
+    time += 1 + random_below(50);
+    for (j = 0; j < N_BOUND; j++)
+        if (down[bound[j]])
+            add_event(s, time, KeyRelease, keycode_of(bound[j]));
+    add_event(s, time, BATCH, 0);
+    if (moving)
+        s->movements++;
+}
+
+static void hash(struct result *r, long value)
+{
+    r->hash = (r->hash ^ value) * 1099511628211UL;
+}
+
+static void check(struct result *r, int condition, const char *message)
+{
+    if (condition)
+        return;
+    if (!r->failed)
+        fprintf(stderr, "  %s\n", message);
+    r->failed = 1;
+}
+
+static void process_clicks(struct keyboard *kb, struct result *r,
+                           int *buttons)
+{
+    struct pointer_click clicks[4];
+    int n, i;
+
+    do {
+        n = compute_pointer_clicks(kb, clicks, 4);
+
+        for (i = 0; i < n; i++) {
+            enum binding binding = clicks[i].binding;
+
+            r->x += clicks[i].dx;
+            r->y += clicks[i].dy;
+            hash(r, clicks[i].dx);
+            hash(r, clicks[i].dy);
+            hash(r, binding * 2 + clicks[i].press);
+
+            check(r, binding >= BINDING_LCLICK && binding <= BINDING_RCLICK,
+                  "click on a non-button binding");
+            check(r, buttons[binding] != clicks[i].press,
+                  "button presses and releases do not alternate");
+            buttons[binding] = clicks[i].press;
+            if (clicks[i].press)
+                r->presses++;
+            else
+                r->releases++;
+        }
+    } while (n == 4);
+}
+
+static void process_movement(struct keyboard *kb, struct result *r)
+{
+    int dx = 0, dy = 0;
+
+    compute_pointer_movement(kb, &dx, &dy);
+    r->x += dx;
+    r->y += dy;
+    hash(r, dx);
+    hash(r, dy);
+}
+
+/* Same sequence of calls as session.c, with ticks every `period` ms */
+static void run(const struct scenario *s, unsigned long period,
+                struct result *r)
+{
+    static struct keyboard kb;
+    KeyCode keycodes[BINDING_COUNT] = { 0 };
+    int buttons[BINDING_COUNT] = { 0 };
+    unsigned long tick = 0;
+    int i, first = 0, ticking = 0;
+
+    memset(r, 0, sizeof(*r));
+
+    keyboard_init(&kb, test_milliseconds);
+    set_detectable_autorepeat(&kb, s->detectable_autorepeat);
+    for (i = 0; i < N_BOUND; i++)
+        keycodes[bound[i]] = keycode_of(bound[i]);
+    set_keycodes(&kb, keycodes);
+
+    for (i = 0; i < s->n_events; i++) {
+        const struct event *event = &s->events[i];
+
+        // Key events are delivered to us all at once at the end of a batch
+        if (event->type != BATCH)
+            continue;
+
+        while (ticking && tick <= event->time) {
+            now = tick;
+            process_clicks(&kb, r, buttons);
+            process_movement(&kb, r);
+            tick += period;
+            ticking = is_currently_moving_pointer(&kb);
+        }
+
+        now = event->time;
+
+        for (; first < i; first++)
+            process_keyboard_event(&kb, s->events[first].type,
+                                   s->events[first].keycode,
+                                   s->events[first].time);
+        first++;
+
+        process_clicks(&kb, r, buttons);
+        if (!is_currently_moving_pointer(&kb))
+            process_movement(&kb, r);
+        if (is_currently_moving_pointer(&kb) && !ticking) {
+            ticking = 1;
+            tick = now;
+        }
+    }
+
+    // Let the last movement finish
+    while (ticking) {
+        now = tick;
+        process_clicks(&kb, r, buttons);
+        process_movement(&kb, r);
+        tick += period;
+        ticking = is_currently_moving_pointer(&kb);
+    }
+
+    check(r, !kb.anomalies, "impossible click state reached");
+    check(r, !buttons[BINDING_LCLICK] && !buttons[BINDING_MCLICK] &&
+          !buttons[BINDING_RCLICK], "button still down at the end");
+    check(r, r->presses == r->releases, "presses and releases differ");
+    check(r, !is_currently_moving_pointer(&kb), "still moving at the end");
+}
+
+static int test_scenario(const struct scenario *s)
+{
+    struct result a, b, c;
+
+    run(s, 20, &a);
+    run(s, 20, &b);
+    run(s, 7, &c);
+
+    check(&a, a.hash == b.hash && a.x == b.x && a.y == b.y,
+          "two runs of the same scenario differ");
+    check(&a, labs(a.x - c.x) <= s->movements &&
+          labs(a.y - c.y) <= s->movements,
+          "movement depends on the tick period");
+    check(&a, a.presses == c.presses, "clicks depend on the tick period");
+
+    return a.failed || b.failed || c.failed;
+}
+
+int main(int argc, char **argv)
+{
+    static struct scenario scenario;
+    int scenarios = argc > 1 ? atoi(argv[1]) : 1000;
+    unsigned long long seed = argc > 2 ? strtoull(argv[2], NULL, 0) : 1;
+    int i, detectable, failures = 0;
+
+    for (i = 0; i < scenarios; i++) {
+        for (detectable = 0; detectable <= 1; detectable++) {
+            rng = (seed + i) * 0x9e3779b97f4a7c15ULL | 1;
+            generate(&scenario, detectable);
+            if (test_scenario(&scenario)) {
+                fprintf(stderr, "FAIL: scenario %d (seed %llu), %s "
+                        "autorepeat\n", i, seed,
+                        detectable ? "detectable" : "fake");
+                failures++;
+            }
+        }
+    }
+
+    printf("%d scenarios, %d failures\n", scenarios * 2, failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}